@@ -85,7 +85,7 @@ static int anm_params[] = { ISUP_CONNECTED_NUMBER, -1};
 
 static int con_params[] = { ISUP_PARM_BACKWARD_CALL_IND, ISUP_CONNECTED_NUMBER, -1};
 
-static int rel_params[] = { ISUP_PARM_CAUSE, -1};
+static int rel_params[] = { ISUP_PARM_CAUSE, ISUP_PARM_AUTO_CONG_LEVEL, -1};
 
 static int greset_params[] = { ISUP_PARM_RANGE_AND_STATUS, -1};
 
@@ -231,6 +231,496 @@ static char * message2str(unsigned char message)
 	}
 }
 
+char * isup_message2str(unsigned char message)
+{
+	return message2str(message);
+}
+
+static inline int isup_dpc_hash(unsigned int dpc)
+{
+	return (dpc ^ (dpc >> 6) ^ (dpc >> 12)) % ISUP_DPC_HASH_SIZE;
+}
+
+static struct isup_dpc * isup_find_dpc(struct ss7 *ss7, unsigned int dpc)
+{
+	struct isup_dpc *d;
+
+	for (d = ss7->isup_dpcs[isup_dpc_hash(dpc)]; d; d = d->next) {
+		if (d->dpc == dpc)
+			return d;
+	}
+
+	return NULL;
+}
+
+static struct isup_dpc * isup_get_dpc(struct ss7 *ss7, unsigned int dpc)
+{
+	struct isup_dpc *d = isup_find_dpc(ss7, dpc);
+	int h;
+
+	if (d)
+		return d;
+
+	d = calloc(1, sizeof(*d));
+	if (!d) {
+		ss7_error(ss7, "Unable to allocate DPC entry\n");
+		return NULL;
+	}
+
+	h = isup_dpc_hash(dpc);
+	d->dpc = dpc;
+	d->stats.dpc = dpc;
+	d->latency.dpc = dpc;
+	d->next = ss7->isup_dpcs[h];
+	ss7->isup_dpcs[h] = d;
+
+	return d;
+}
+
+/* Counts into the linkset totals and the DPC's own counters */
+#define ISUP_COUNT(ss7, dpc, counter) do { \
+	struct isup_dpc *__d = isup_get_dpc(ss7, dpc); \
+	(ss7)->isup_stats.counter++; \
+	if (__d) \
+		__d->stats.counter++; \
+} while (0)
+
+void isup_free_all_dpcs(struct ss7 *ss7)
+{
+	struct isup_dpc *d;
+	int i;
+
+	for (i = 0; i < ISUP_DPC_HASH_SIZE; i++) {
+		while ((d = ss7->isup_dpcs[i])) {
+			ss7->isup_dpcs[i] = d->next;
+			free(d);
+		}
+	}
+}
+
+static void isup_stats_add(struct isup_stats *to, struct isup_stats *from)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		to->msg_tx[i] += from->msg_tx[i];
+		to->msg_rx[i] += from->msg_rx[i];
+	}
+	for (i = 0; i < 128; i++) {
+		to->rel_cause_tx[i] += from->rel_cause_tx[i];
+		to->rel_cause_rx[i] += from->rel_cause_rx[i];
+	}
+	for (i = 0; i < ISUP_STATS_MAX_TIMERS; i++)
+		to->timer_expiries[i] += from->timer_expiries[i];
+	to->unexpected += from->unexpected;
+	to->dual_seizures += from->dual_seizures;
+	to->event_drops += from->event_drops;
+	to->acl_rx += from->acl_rx;
+	to->gapped += from->gapped;
+	to->overload_rels += from->overload_rels;
+}
+
+/* Calls of a sharded linkset are counted by the shards, the linkset itself
+ * is instance 0 */
+static inline int isup_instances(struct ss7 *ss7)
+{
+	return ss7->shards ? ss7->numshards + 1 : 1;
+}
+
+static inline struct ss7 * isup_instance(struct ss7 *ss7, int i)
+{
+	return i ? ss7->shards[i - 1] : ss7;
+}
+
+int isup_get_stats(struct ss7 *ss7, struct isup_stats *stats)
+{
+	int i;
+
+	if (!ss7 || !stats)
+		return -1;
+
+	*stats = ss7->isup_stats;
+
+	for (i = 1; i < isup_instances(ss7); i++)
+		isup_stats_add(stats, &isup_instance(ss7, i)->isup_stats);
+
+	return 0;
+}
+
+int isup_get_dpc_stats(struct ss7 *ss7, unsigned int dpc, struct isup_stats *stats)
+{
+	struct isup_dpc *d;
+	int i, found = 0;
+
+	if (!ss7 || !stats)
+		return -1;
+
+	for (i = 0; i < isup_instances(ss7); i++) {
+		d = isup_find_dpc(isup_instance(ss7, i), dpc);
+		if (!d)
+			continue;
+		if (found++)
+			isup_stats_add(stats, &d->stats);
+		else
+			*stats = d->stats;
+	}
+
+	return found ? 0 : -1;
+}
+
+int isup_get_dpcs(struct ss7 *ss7, unsigned int *dpcs, int max)
+{
+	struct isup_dpc *d;
+	int i, j, k, res = 0;
+
+	if (!ss7 || !dpcs)
+		return -1;
+
+	for (k = 0; k < isup_instances(ss7); k++) {
+		for (i = 0; i < ISUP_DPC_HASH_SIZE; i++) {
+			for (d = isup_instance(ss7, k)->isup_dpcs[i]; d && res < max; d = d->next) {
+				/* Shards share the DPCs of the CICs they got */
+				for (j = 0; j < res && dpcs[j] != d->dpc; j++)
+					;
+				if (j == res)
+					dpcs[res++] = d->dpc;
+			}
+		}
+	}
+
+	return res;
+}
+
+static void isup_reset_instance_stats(struct ss7 *ss7)
+{
+	struct isup_dpc *d;
+	int i;
+
+	memset(&ss7->isup_stats, 0, sizeof(ss7->isup_stats));
+
+	for (i = 0; i < ISUP_DPC_HASH_SIZE; i++) {
+		for (d = ss7->isup_dpcs[i]; d; d = d->next) {
+			memset(&d->stats, 0, sizeof(d->stats));
+			d->stats.dpc = d->dpc;
+		}
+	}
+}
+
+void isup_reset_stats(struct ss7 *ss7)
+{
+	int i;
+
+	if (!ss7)
+		return;
+
+	for (i = 0; i < isup_instances(ss7); i++)
+		isup_reset_instance_stats(isup_instance(ss7, i));
+}
+
+/* Q.764 2.11 defaults, used until the timers are configured */
+#define ISUP_DEFAULT_T29	300
+#define ISUP_DEFAULT_T30	5000
+
+static long isup_acc_timer(struct ss7 *ss7, int timer)
+{
+	if (ss7->isup_timers[timer] > 0)
+		return ss7->isup_timers[timer];
+
+	return (timer == ISUP_TIMER_T29) ? ISUP_DEFAULT_T29 : ISUP_DEFAULT_T30;
+}
+
+/* Returns 0 if a call may go */
+/* Each of 'shares' buckets refilling at 'rate' lets through 1/shares of it */
+static int isup_bucket_take(struct ss7_bucket *b, unsigned int rate, unsigned int burst, unsigned int shares, struct timeval *now)
+{
+	unsigned long long max = (unsigned long long) burst * 1000000;
+	unsigned long long call = (unsigned long long) shares * 1000000;
+	long usec;
+
+	if (!rate)
+		return 0;
+
+	if (max < call)
+		max = call;
+
+	if (b->last.tv_sec) {
+		usec = ss7_tvdiff_usec(now, &b->last);
+		if (usec > 0)
+			b->tokens += (unsigned long long) usec * rate;
+	} else
+		b->tokens = max;
+	if (b->tokens > max)
+		b->tokens = max;
+	b->last = *now;
+
+	if (b->tokens < call)
+		return -1;
+
+	b->tokens -= call;
+	return 0;
+}
+
+/* The level goes down by one for each T30 since it last changed */
+static int isup_dpc_acl(struct ss7 *ss7, struct isup_dpc *d, struct timeval *now)
+{
+	long t30 = isup_acc_timer(ss7, ISUP_TIMER_T30) * 1000;
+
+	while (d->acl && ss7_tvdiff_usec(now, &d->acl_time) >= t30) {
+		d->acl--;
+		d->acl_time.tv_sec += t30 / 1000000;
+		d->acl_time.tv_usec += t30 % 1000000;
+		if (d->acl_time.tv_usec >= 1000000) {
+			d->acl_time.tv_sec++;
+			d->acl_time.tv_usec -= 1000000;
+		}
+		if (!d->acl)
+			ss7_message(ss7, "DPC %d no longer congested\n", d->dpc);
+	}
+
+	return d->acl;
+}
+
+static void isup_acl_receive(struct ss7 *ss7, unsigned int opc, int acl)
+{
+	struct isup_dpc *d;
+	struct timeval now;
+
+	ISUP_COUNT(ss7, opc, acl_rx);
+
+	d = isup_get_dpc(ss7, opc);
+	if (!d)
+		return;
+
+	gettimeofday(&now, NULL);
+
+	/* Releases of the same congestion keep coming in during T29 */
+	if (isup_dpc_acl(ss7, d, &now) && ss7_tvdiff_usec(&now, &d->acl_time) < isup_acc_timer(ss7, ISUP_TIMER_T29) * 1000)
+		return;
+
+	if (acl > d->acl) {
+		ss7_message(ss7, "DPC %d at automatic congestion level %d\n", opc, acl);
+		d->acl = acl;
+	}
+	d->acl_time = now;
+}
+
+/* Call gapping of a new outgoing call, -1 to refuse it */
+static int isup_gap_call(struct ss7 *ss7, unsigned int dpc)
+{
+	struct isup_dpc *d = isup_find_dpc(ss7, dpc);
+	struct timeval now;
+	int acl;
+
+	if (!ss7->call_gap[0].rate && (!d || !d->acl))
+		return 0;
+
+	gettimeofday(&now, NULL);
+
+	acl = d ? isup_dpc_acl(ss7, d, &now) : 0;
+	if (acl && isup_bucket_take(&d->gap, ss7->call_gap[acl].rate, ss7->call_gap[acl].burst, ss7->call_gap_shares, &now))
+		return -1;
+
+	return isup_bucket_take(&ss7->call_gap[0], ss7->call_gap[0].rate, ss7->call_gap[0].burst, ss7->call_gap_shares, &now);
+}
+
+/* Our own congestion level, from the events the application has not taken */
+static int isup_overload_level(struct ss7 *ss7)
+{
+	unsigned int backlog;
+
+	if (!ss7->overload[0])
+		return 0;
+
+	backlog = ss7_event_backlog(ss7);
+	if (ss7->overload[1] && backlog >= ss7->overload[1])
+		return 2;
+
+	return (backlog >= ss7->overload[0]) ? 1 : 0;
+}
+
+int ss7_set_call_gapping(struct ss7 *ss7, int level, unsigned int rate, unsigned int burst)
+{
+	if (!ss7)
+		return -1;
+
+	if (level < 0 || level > 2) {
+		ss7_error(ss7, "Invalid call gapping level %d\n", level);
+		return -1;
+	}
+
+	memset(&ss7->call_gap[level], 0, sizeof(ss7->call_gap[level]));
+	ss7->call_gap[level].rate = rate;
+	ss7->call_gap[level].burst = burst ? burst : 1;
+
+	return 0;
+}
+
+int isup_get_acl(struct ss7 *ss7, unsigned int dpc)
+{
+	struct isup_dpc *d;
+	struct timeval now;
+	int i, acl, max = 0;
+
+	if (!ss7)
+		return 0;
+
+	gettimeofday(&now, NULL);
+
+	/* Each shard hears the RELs of its own CICs */
+	for (i = 0; i < isup_instances(ss7); i++) {
+		d = isup_find_dpc(isup_instance(ss7, i), dpc);
+		if (d && (acl = isup_dpc_acl(isup_instance(ss7, i), d, &now)) > max)
+			max = acl;
+	}
+
+	return max;
+}
+
+int ss7_set_isup_overload(struct ss7 *ss7, unsigned int level1, unsigned int level2)
+{
+	if (!ss7)
+		return -1;
+
+	if (level2 && level2 < level1) {
+		ss7_error(ss7, "Overload level 2 threshold below level 1\n");
+		return -1;
+	}
+
+	ss7->overload[0] = level1;
+	ss7->overload[1] = level1 ? level2 : 0;
+
+	return 0;
+}
+
+static const char * const isup_latency_names[ISUP_LAT_MAX] = {
+	"IAM-ACM", "IAM-ANM", "REL-RLC", "GRS-GRA", "BLO-BLA",
+	"in IAM-ACM", "in IAM-ANM", "in REL-RLC", "in GRS-GRA", "in BLO-BLA",
+};
+
+const char * isup_latency2str(int proc)
+{
+	if (proc < 0 || proc >= ISUP_LAT_MAX)
+		return "Unknown";
+
+	return isup_latency_names[proc];
+}
+
+static inline void isup_latency_start(struct timeval *start)
+{
+	gettimeofday(start, NULL);
+}
+
+/* Time since 'start' goes into the linkset and DPC histograms of the procedure */
+static void isup_latency_end(struct ss7 *ss7, unsigned int dpc, int proc, struct timeval *start, int clear)
+{
+	struct isup_dpc *d;
+	struct timeval now;
+	long usec;
+
+	if (!start->tv_sec)
+		return;
+
+	gettimeofday(&now, NULL);
+	usec = ss7_tvdiff_usec(&now, start);
+
+	ss7_hist_add(&ss7->isup_latency.proc[proc], usec);
+	d = isup_get_dpc(ss7, dpc);
+	if (d)
+		ss7_hist_add(&d->latency.proc[proc], usec);
+
+	if (clear)
+		timerclear(start);
+}
+
+static void isup_latency_add(struct isup_latency *to, struct isup_latency *from)
+{
+	int i;
+
+	for (i = 0; i < ISUP_LAT_MAX; i++)
+		ss7_hist_merge(&to->proc[i], &from->proc[i]);
+}
+
+int isup_get_latency(struct ss7 *ss7, struct isup_latency *lat, int reset)
+{
+	struct ss7 *s;
+	int i;
+
+	if (!ss7 || !lat)
+		return -1;
+
+	memset(lat, 0, sizeof(*lat));
+	for (i = 0; i < isup_instances(ss7); i++) {
+		s = isup_instance(ss7, i);
+		isup_latency_add(lat, &s->isup_latency);
+		if (reset)
+			memset(&s->isup_latency, 0, sizeof(s->isup_latency));
+	}
+
+	return 0;
+}
+
+int isup_get_dpc_latency(struct ss7 *ss7, unsigned int dpc, struct isup_latency *lat, int reset)
+{
+	struct isup_dpc *d;
+	int i, found = 0;
+
+	if (!ss7 || !lat)
+		return -1;
+
+	memset(lat, 0, sizeof(*lat));
+	lat->dpc = dpc;
+	for (i = 0; i < isup_instances(ss7); i++) {
+		d = isup_find_dpc(isup_instance(ss7, i), dpc);
+		if (!d)
+			continue;
+		isup_latency_add(lat, &d->latency);
+		if (reset) {
+			memset(&d->latency, 0, sizeof(d->latency));
+			d->latency.dpc = dpc;
+		}
+		found = 1;
+	}
+
+	return found ? 0 : -1;
+}
+
+static void isup_reset_instance_latency(struct ss7 *ss7)
+{
+	struct isup_dpc *d;
+	int i;
+
+	memset(&ss7->isup_latency, 0, sizeof(ss7->isup_latency));
+
+	for (i = 0; i < ISUP_DPC_HASH_SIZE; i++) {
+		for (d = ss7->isup_dpcs[i]; d; d = d->next) {
+			memset(&d->latency, 0, sizeof(d->latency));
+			d->latency.dpc = d->dpc;
+		}
+	}
+}
+
+void isup_reset_latency(struct ss7 *ss7)
+{
+	int i;
+
+	if (!ss7)
+		return;
+
+	for (i = 0; i < isup_instances(ss7); i++)
+		isup_reset_instance_latency(isup_instance(ss7, i));
+}
+
+/* Event for a call; a full queue is counted against the call's DPC */
+static ss7_event * isup_next_event(struct ss7 *ss7, struct isup_call *c)
+{
+	ss7_event *e = ss7_next_empty_event(ss7);
+
+	if (!e)
+		ISUP_COUNT(ss7, c->dpc, event_drops);
+
+	return e;
+}
+
 static char char2digit(char localchar)
 {
 	switch (localchar) {
@@ -2430,6 +2920,28 @@ static FUNC_SEND(cug_interlock_code_transmit)
 	return 4;
 }
 
+static FUNC_DUMP(auto_cong_level_dump)
+{
+	ss7_message(ss7, "\t\t\tCongestion level %i exceeded\n", parm[0]);
+	return 1;
+}
+
+static FUNC_RECV(auto_cong_level_receive)
+{
+	/* Spare values are taken as level 1 */
+	c->acl = (parm[0] == 2) ? 2 : 1;
+	return 1;
+}
+
+static FUNC_SEND(auto_cong_level_transmit)
+{
+	if (!c->acl)
+		return 0;
+
+	parm[0] = c->acl;
+	return 1;
+}
+
 static struct parm_func parms[] = {
 	{ISUP_PARM_NATURE_OF_CONNECTION_IND, "Nature of Connection Indicator", nature_of_connection_ind_dump, nature_of_connection_ind_receive, nature_of_connection_ind_transmit },
 	{ISUP_PARM_FORWARD_CALL_IND, "Forward Call Indicators", forward_call_ind_dump, forward_call_ind_receive, forward_call_ind_transmit },
@@ -2480,7 +2992,8 @@ static struct parm_func parms[] = {
 	{ISUP_PARM_INR_IND, "Information Request Indicators", inr_ind_dump, inr_ind_receive, inr_ind_transmit},
 	{ISUP_PARM_INF_IND, "Information Indicators", inf_ind_dump, inf_ind_receive, inf_ind_transmit},
 	{ISUP_PARM_SUBSEQUENT_NUMBER, "Subsequent Number", subs_num_dump, subs_num_receive, subs_num_transmit},
-	{ISUP_CONNECTED_NUMBER, "Connected Number", connected_num_dump, connected_num_receive, connected_num_transmit}
+	{ISUP_CONNECTED_NUMBER, "Connected Number", connected_num_dump, connected_num_receive, connected_num_transmit},
+	{ISUP_PARM_AUTO_CONG_LEVEL, "Automatic Congestion Level", auto_cong_level_dump, auto_cong_level_receive, auto_cong_level_transmit}
 };
 
 static char * param2str(int parm)
@@ -2524,6 +3037,7 @@ static struct isup_call * __isup_new_call(struct ss7 *ss7, int nolink)
 			cur->next = c;
 		} else
 			ss7->calls = c;
+		ss7->numcalls++;
 
 		return c;
 	}
@@ -2534,6 +3048,29 @@ struct isup_call * isup_new_call(struct ss7 *ss7)
 	return __isup_new_call(ss7, 0);
 }
 
+struct isup_call * isup_new_call_nolink(struct ss7 *ss7)
+{
+	return __isup_new_call(ss7, 1);
+}
+
+void isup_link_call(struct ss7 *ss7, struct isup_call *c)
+{
+	struct isup_call *cur;
+
+	for (cur = ss7->calls; cur; cur = cur->next) {
+		if (cur == c)
+			return;
+		if (!cur->next) {
+			cur->next = c;
+			ss7->numcalls++;
+			return;
+		}
+	}
+
+	ss7->calls = c;
+	ss7->numcalls++;
+}
+
 void isup_set_call_dpc(struct isup_call *c, unsigned int dpc)
 {
 	c->dpc = dpc;
@@ -2757,6 +3294,7 @@ void isup_free_call(struct ss7 *ss7, struct isup_call *c)
 			ss7->calls = winner->next;
 		else
 			prev->next = winner->next;
+		ss7->numcalls--;
 
 		isup_stop_all_timers(ss7, c);
 		free(c);
@@ -2870,7 +3408,7 @@ static int dump_parm(struct ss7 *ss7, int message, int parm, unsigned char *parm
 	return optparm->len + 2;
 }
 
-static int isup_send_message(struct ss7 *ss7, struct isup_call *c, int messagetype, int parms[])
+static int __isup_send_message(struct ss7 *ss7, struct isup_call *c, int messagetype, int parms[])
 {
 	struct ss7_msg *msg;
 	struct isup_h *mh = NULL;
@@ -3008,7 +3546,15 @@ static int isup_send_message(struct ss7 *ss7, struct isup_call *c, int messagety
 
 	ss7_msg_userpart_len(msg, offset + rlsize + CIC_SIZE + 1);   /* Message type length is 1 */
 
-	return mtp3_transmit(ss7, SIG_ISUP, rl, msg, NULL);
+	res = mtp3_transmit(ss7, SIG_ISUP, rl, msg, NULL);
+
+	if (res > -1) {
+		ISUP_COUNT(ss7, c->dpc, msg_tx[messagetype & 0xff]);
+		if (messagetype == ISUP_REL)
+			ISUP_COUNT(ss7, c->dpc, rel_cause_tx[c->cause & 0x7f]);
+	}
+
+	return res;
 }
 
 int isup_dump(struct ss7 *ss7, struct mtp2 *link, unsigned char *buf, int len)
@@ -3153,6 +3699,8 @@ static int isup_check_status(unsigned char *sent_status, unsigned char *got_stat
 static int isup_handle_unexpected (struct ss7 *ss7, struct isup_call *c, unsigned int opc) {
 	int res;
 
+	ISUP_COUNT(ss7, opc, unexpected);
+
 	if (c->got_sent_msg & (ISUP_CALL_CONNECTED)) {
 		ss7_message(ss7, "ignoring... \n");
 	} else {
@@ -3166,7 +3714,7 @@ static int isup_handle_unexpected (struct ss7 *ss7, struct isup_call *c, unsigne
 		return 0;
 }
 
-int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, unsigned char *buf, int len)
+static int __isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, unsigned char *buf, int len)
 {
 	unsigned short cic;
 	struct isup_h *mh;
@@ -3191,6 +3739,8 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 		cic = mh->cic[0] | ((mh->cic[1] & 0x3f) << 8);
 	}
 
+	ISUP_COUNT(ss7, opc, msg_rx[mh->type]);
+
 	/* Find us in the message list */
 	for (x = 0; x < sizeof(messages)/sizeof(struct message_data); x++)
 		if (messages[x].messagetype == mh->type)
@@ -3288,7 +3838,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3345,7 +3895,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				ss7_call_null(ss7, c, 1);
 			return 0;
 		case ISUP_CQM:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3359,13 +3909,14 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->cqm.call = c;
 			return 0;
 		case ISUP_GRS:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
 				return -1;
 			}
 
+			isup_latency_start(&c->lat_grs);
 			e->e = ISUP_EVENT_GRS;
 			e->grs.startcic = cic;
 			e->grs.endcic = cic + c->range;
@@ -3383,7 +3934,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return 0;
 			}
 	
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3399,12 +3950,13 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->gra.call = c;
 			e->gra.sent_endcic = c->sent_grs_endcic;
 			e->gra.got_sent_msg = c->got_sent_msg;
+			isup_latency_end(ss7, opc, ISUP_LAT_GRS_GRA, &c->lat_grs, 1);
 			c->got_sent_msg &= ~ISUP_SENT_GRS;
 			isup_stop_timer(ss7, c, ISUP_TIMER_T22);
 			isup_stop_timer(ss7, c, ISUP_TIMER_T23);
 			return 0;
 		case ISUP_RSC:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3419,7 +3971,10 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			c->got_sent_msg = 0;
 			return 0;
 		case ISUP_REL:
-			e = ss7_next_empty_event(ss7);
+			ISUP_COUNT(ss7, opc, rel_cause_rx[c->cause & 0x7f]);
+			if (c->acl)
+				isup_acl_receive(ss7, opc, c->acl);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3432,12 +3987,15 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			isup_stop_timer(ss7, c, ISUP_TIMER_T35);
 			isup_stop_timer(ss7, c, ISUP_TIMER_DIGITTIMEOUT);
 			c->got_sent_msg &= ~(ISUP_CALL_CONNECTED | ISUP_SENT_IAM | ISUP_GOT_IAM | ISUP_GOT_CCR | ISUP_SENT_INR);
+			isup_latency_start(&c->lat_rel);
 			e->e = ISUP_EVENT_REL;
 			e->rel.cic = c->cic;
 			e->rel.call = c;
 			e->rel.cause = c->cause;
 			e->rel.opc = opc; /* keep OPC information */
 			e->rel.got_sent_msg = c->got_sent_msg;
+			e->rel.acl = c->acl;
+			c->acl = 0;
 			return 0;
 		case ISUP_ACM:
 			if (!(c->got_sent_msg & ISUP_SENT_IAM)) {
@@ -3445,7 +4003,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3453,6 +4011,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			}
 
 			isup_stop_timer(ss7, c, ISUP_TIMER_T7);
+			isup_latency_end(ss7, opc, ISUP_LAT_IAM_ACM, &c->lat_iam, 0);
 			c->got_sent_msg |= ISUP_GOT_ACM;
 			e->e = ISUP_EVENT_ACM;
 			e->acm.cic = c->cic;
@@ -3470,7 +4029,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3478,6 +4037,8 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			}
 
 			isup_stop_timer(ss7, c, ISUP_TIMER_T7);
+			isup_latency_end(ss7, opc, ISUP_LAT_IAM_ACM, &c->lat_iam, 0);
+			isup_latency_end(ss7, opc, ISUP_LAT_IAM_ANM, &c->lat_iam, 1);
 			c->got_sent_msg |= ISUP_GOT_CON;
 			e->e = ISUP_EVENT_CON;
 			e->con.cic = c->cic;
@@ -3496,13 +4057,14 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
 				return -1;
 			}
 
+			isup_latency_end(ss7, opc, ISUP_LAT_IAM_ANM, &c->lat_iam, 1);
 			c->got_sent_msg |= ISUP_GOT_ANM;
 			e->e = ISUP_EVENT_ANM;
 			e->anm.cic = c->cic;
@@ -3521,7 +4083,15 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			/* The application never saw the call */
+			if (c->overload_rel) {
+				isup_stop_timer(ss7, c, ISUP_TIMER_T1);
+				isup_stop_timer(ss7, c, ISUP_TIMER_T5);
+				isup_free_call(ss7, c);
+				return 0;
+			}
+
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3533,6 +4103,8 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->rlc.opc = opc; /* keep OPC information */
 			e->rlc.call = c;
 			e->rlc.got_sent_msg = c->got_sent_msg;
+			if (c->got_sent_msg & ISUP_SENT_REL)
+				isup_latency_end(ss7, opc, ISUP_LAT_REL_RLC, &c->lat_rel, 1);
 			c->got_sent_msg &= ~(ISUP_SENT_REL | ISUP_SENT_RSC);
 			isup_stop_timer(ss7, c, ISUP_TIMER_T2);
 			isup_stop_timer(ss7, c, ISUP_TIMER_T6);
@@ -3548,7 +4120,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3570,7 +4142,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				isup_start_timer(ss7, c, ISUP_TIMER_T27);
 			return 0;
 		case ISUP_CCR:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3585,7 +4157,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			isup_stop_timer(ss7, c, ISUP_TIMER_T27);
 			return 0;
 		case ISUP_CVT:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3597,13 +4169,14 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->cvt.call = c;
 			return 0;
 		case ISUP_BLO:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
 				return -1;
 			}
 
+			isup_latency_start(&c->lat_blo);
 			e->e = ISUP_EVENT_BLO;
 			e->blo.cic = c->cic;
 			e->blo.opc = opc; /* keep OPC information */
@@ -3611,7 +4184,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->blo.got_sent_msg = c->got_sent_msg;
 			return 0;
 		case ISUP_UBL:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3629,7 +4202,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3644,10 +4217,11 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->bla.opc = opc; /* keep OPC information */
 			e->bla.call = c;
 			e->bla.got_sent_msg = c->got_sent_msg;
+			isup_latency_end(ss7, opc, ISUP_LAT_BLO_BLA, &c->lat_blo, 1);
 			c->got_sent_msg &= ~ISUP_SENT_BLO;			
 			return 0;
 		case ISUP_LPA:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3664,7 +4238,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				ss7_message(ss7, "Got UBA but we didn't send UBL on CIC %d PC %d ", c->cic, opc);
 				return isup_handle_unexpected(ss7, c, opc);
 			}
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3683,7 +4257,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			c->got_sent_msg &= ~ISUP_SENT_UBL;
 			return 0;
 		case ISUP_CGB:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3701,7 +4275,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->cgb.call = c;
 			return 0;
 		case ISUP_CGU:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3724,7 +4298,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return isup_handle_unexpected(ss7, c, opc);
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3740,7 +4314,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->cpg.echocontrol_ind = c->echocontrol_ind;
 			return 0;
 		case ISUP_UCIC:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3753,7 +4327,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->ucic.call = c;
 			return 0;
 		case ISUP_FAA:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3768,7 +4342,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			e->faa.call = c;
 			return 0;
 		case ISUP_FAR:
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3793,7 +4367,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				ss7_message(ss7, "Got CGBA doesn't match with the sent CGB on CIC %d DPC %d\n", c->cic, opc);
 				return 0;
 			}
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3827,7 +4401,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				return 0;
 			}
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3858,7 +4432,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 			if (c->got_sent_msg & (ISUP_SENT_RSC | ISUP_SENT_REL))
 				return 0; /* ignoring SUS we are in hangup now */
 
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3882,7 +4456,7 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 				ss7_message(ss7, "Got RES but no call on CIC %d PC %d ", c->cic, opc);
 				return isup_handle_unexpected(ss7, c, opc);
 			}
-			e = ss7_next_empty_event(ss7);
+			e = isup_next_event(ss7, c);
 			if (!e) {
 				ss7_call_null(ss7, c, 1);
 				isup_free_call(ss7, c);
@@ -3908,12 +4482,24 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, u
 	}
 }
 
+int isup_receive(struct ss7 *ss7, struct mtp2 *link, struct routing_label *rl, unsigned char *buf, int len)
+{
+	int res;
+
+	SS7_PROF_ENTER(ss7);
+	res = __isup_receive(ss7, link, rl, buf, len);
+	SS7_PROF_LEAVE(ss7, SS7_PROF_ISUP_DECODE, ((struct isup_h *) buf)->type);
+
+	return res;
+}
+
 int isup_event_iam(struct ss7 *ss7, struct isup_call *c, int opc)
 {
 	ss7_event *e;
 
 	/* Checking dual seizure */
 	if (c->got_sent_msg == ISUP_SENT_IAM) {
+		ISUP_COUNT(ss7, opc, dual_seizures);
 		if ((ss7->pc > opc) ? (~c->cic & 1) : (c->cic & 1)) {
 			ss7_message(ss7, "Dual seizure on CIC %d DPC %d we are the controlling, ignore IAM\n", c->cic, opc);
 			return 0;
@@ -3925,6 +4511,19 @@ int isup_event_iam(struct ss7 *ss7, struct isup_call *c, int opc)
 		}
 	}
 
+	/* In overload new calls go back at once, with our level in the REL */
+	if (isup_overload_level(ss7)) {
+		ISUP_COUNT(ss7, opc, overload_rels);
+		ss7_message(ss7, "Overload, IAM on CIC %d from DPC %d released\n", c->cic, opc);
+		c->dpc = opc;
+		c->overload_rel = 1;
+		isup_rel(ss7, c, 42); /* switching equipment congestion */
+		return 0;
+	}
+
+	/* An IAM completed by INF keeps the time of the original IAM */
+	if (!(c->got_sent_msg & ISUP_GOT_IAM))
+		isup_latency_start(&c->lat_iam);
 	c->got_sent_msg |= ISUP_GOT_IAM;
 
 	if ((ss7->flags & SS7_INR_IF_NO_CALLING) && 
@@ -3934,7 +4533,7 @@ int isup_event_iam(struct ss7 *ss7, struct isup_call *c, int opc)
 		return 0;
 	}
 
-	e = ss7_next_empty_event(ss7);
+	e = isup_next_event(ss7, c);
 	if (!e) {
 		ss7_call_null(ss7, c, 1);
 		isup_free_call(ss7, c);
@@ -4047,6 +4646,7 @@ int isup_grs(struct ss7 *ss7, struct isup_call *c, int endcic)
 	res = isup_send_message(ss7, c, ISUP_GRS, greset_params);
 
 	if (res > -1) {
+		isup_latency_start(&c->lat_grs);
 		c->got_sent_msg = ISUP_SENT_GRS;
 		c->sent_grs_endcic = endcic;
 		isup_stop_all_timers(ss7, c);
@@ -4078,7 +4678,9 @@ int isup_gra(struct ss7 *ss7, struct isup_call *c, int endcic, unsigned char sta
 
 	res = isup_send_message(ss7, c, ISUP_GRA, greset_params);
 
-	if (res == -1) {
+	if (res > -1) {
+		isup_latency_end(ss7, c->dpc, ISUP_LAT_IN_GRS_GRA, &c->lat_grs, 1);
+	} else {
 		ss7_call_null(ss7, c, 0);
 		isup_free_call(ss7, c);
 		ss7_error(ss7, "Unable to send GRA to DPC: %d\n", c->dpc);
@@ -4212,12 +4814,29 @@ int isup_iam(struct ss7 *ss7, struct isup_call *c)
 	if (!ss7 || !c)
 		return -1;
 
+	/* New calls would only make the congestion worse */
+	if (ss7_get_congestion(ss7) || mtp3_dest_congestion(ss7, c->dpc)) {
+		ss7_message(ss7, "Linkset or DPC congested, IAM to DPC: %d not sent\n", c->dpc);
+		ss7_call_null(ss7, c, 0);
+		isup_free_call(ss7, c);
+		return -2;
+	}
+
+	if (isup_gap_call(ss7, c->dpc)) {
+		ISUP_COUNT(ss7, c->dpc, gapped);
+		ss7_message(ss7, "Call gapping, IAM to DPC: %d not sent\n", c->dpc);
+		ss7_call_null(ss7, c, 0);
+		isup_free_call(ss7, c);
+		return -2;
+	}
+
 	if (ss7->switchtype == SS7_ITU)
 		res = isup_send_message(ss7, c, ISUP_IAM, iam_params);
 	else
 		res = isup_send_message(ss7, c, ISUP_IAM, ansi_iam_params);
 
 	if (res > -1) {
+		isup_latency_start(&c->lat_iam);
 		isup_start_timer(ss7, c, ISUP_TIMER_T7);
 		c->got_sent_msg |= ISUP_SENT_IAM;
 	} else {
@@ -4238,6 +4857,7 @@ int isup_acm(struct ss7 *ss7, struct isup_call *c)
 	res = isup_send_message(ss7, c, ISUP_ACM, acm_params);
 
 	if (res > -1) {
+		isup_latency_end(ss7, c->dpc, ISUP_LAT_IN_IAM_ACM, &c->lat_iam, 0);
 		c->got_sent_msg |= ISUP_SENT_ACM;
 		isup_stop_timer(ss7, c, ISUP_TIMER_T35);
 		isup_stop_timer(ss7, c, ISUP_TIMER_DIGITTIMEOUT);
@@ -4301,6 +4921,7 @@ int isup_anm(struct ss7 *ss7, struct isup_call *c)
 	res = isup_send_message(ss7, c, ISUP_ANM, anm_params);
 
 	if (res > -1) {
+		isup_latency_end(ss7, c->dpc, ISUP_LAT_IN_IAM_ANM, &c->lat_iam, 1);
 		c->got_sent_msg |= ISUP_SENT_ANM;
 		isup_stop_timer(ss7, c, ISUP_TIMER_T35);
 		isup_stop_timer(ss7, c, ISUP_TIMER_DIGITTIMEOUT);
@@ -4325,6 +4946,8 @@ int isup_con(struct ss7 *ss7, struct isup_call *c)
 	res = isup_send_message(ss7, c, ISUP_CON, con_params);
 
 	if ( res > -1) {
+		isup_latency_end(ss7, c->dpc, ISUP_LAT_IN_IAM_ACM, &c->lat_iam, 0);
+		isup_latency_end(ss7, c->dpc, ISUP_LAT_IN_IAM_ANM, &c->lat_iam, 1);
 		c->got_sent_msg |= ISUP_SENT_CON;
 	} else {
 		ss7_call_null(ss7, c, 0);
@@ -4347,6 +4970,7 @@ int isup_rel(struct ss7 *ss7, struct isup_call *c, int cause)
 	c->cause = cause;
 	c->causecode = CODE_CCITT;
 	c->causeloc = ss7->cause_location;
+	c->acl = isup_overload_level(ss7);
 
 	res = isup_send_message(ss7, c, ISUP_REL, rel_params);
 
@@ -4360,6 +4984,7 @@ int isup_rel(struct ss7 *ss7, struct isup_call *c, int cause)
 		isup_stop_timer(ss7, c, ISUP_TIMER_DIGITTIMEOUT);
 		isup_start_timer(ss7, c, ISUP_TIMER_T1);
 		isup_start_timer(ss7, c, ISUP_TIMER_T5);
+		isup_latency_start(&c->lat_rel);
 
 		c->got_sent_msg |= ISUP_SENT_REL;
 		c->got_sent_msg &= ~(ISUP_SENT_IAM | ISUP_CALL_CONNECTED | ISUP_GOT_IAM | ISUP_GOT_CCR | ISUP_SENT_INR);
@@ -4381,7 +5006,9 @@ int isup_rlc(struct ss7 *ss7, struct isup_call *c)
 
 	res = isup_send_message(ss7, c, ISUP_RLC, empty_params);
 
-	if (res == -1) {
+	if (res > -1) {
+		isup_latency_end(ss7, c->dpc, ISUP_LAT_IN_REL_RLC, &c->lat_rel, 1);
+	} else {
 		ss7_call_null(ss7, c, 0);
 		isup_free_call(ss7, c);
 		ss7_error(ss7, "Unable to send RLC to DPC: %d\n", c->dpc);
@@ -4471,6 +5098,17 @@ int isup_res(struct ss7 *ss7, struct isup_call *c, unsigned char indicator)
 	return res;
 }
 
+static int isup_send_message(struct ss7 *ss7, struct isup_call *c, int messagetype, int parms[])
+{
+	int res;
+
+	SS7_PROF_ENTER(ss7);
+	res = __isup_send_message(ss7, c, messagetype, parms);
+	SS7_PROF_LEAVE(ss7, SS7_PROF_ISUP_ENCODE, messagetype);
+
+	return res;
+}
+
 static int isup_send_message_ciconly(struct ss7 *ss7, int messagetype, int cic, unsigned int dpc)
 {
 	int res;
@@ -4533,6 +5171,7 @@ int isup_blo(struct ss7 *ss7, struct isup_call *c)
 	res = isup_send_message(ss7, c, ISUP_BLO, empty_params);
 
 	if (res > -1) {
+		isup_latency_start(&c->lat_blo);
 		isup_start_timer(ss7, c, ISUP_TIMER_T12);
 		isup_start_timer(ss7, c, ISUP_TIMER_T13);
 		c->got_sent_msg |= ISUP_SENT_BLO;
@@ -4575,7 +5214,9 @@ int isup_bla(struct ss7 *ss7, struct isup_call *c)
 
 	res = isup_send_message(ss7, c, ISUP_BLA, empty_params);
 
-	if (res == -1) {
+	if (res > -1) {
+		isup_latency_end(ss7, c->dpc, ISUP_LAT_IN_BLO_BLA, &c->lat_blo, 1);
+	} else {
 		ss7_call_null(ss7, c, 0);
 		isup_free_call(ss7, c);
 		ss7_error(ss7, "Unable to send BLA to DPC: %d\n", c->dpc);
@@ -4646,6 +5287,176 @@ int isup_cvr(struct ss7 *ss7, int cic, unsigned int dpc)
 	return res;
 }
 
+static int isup_snapshot_calls(struct ss7 *ss7)
+{
+	struct isup_call_snapshot *snap = ss7->call_snapshot;
+	struct isup_call_slot *slot;
+	struct isup_call_info *info, *tmp;
+	struct isup_call *c;
+	struct timeval now;
+	long ms;
+	int s, x, n = 0;
+
+	s = (snap->current == 0) ? 1 : 0;
+	slot = &snap->slot[s];
+
+	/* A reader still copies from it, try again next time rather than wait */
+	if (slot->refs) {
+		snap->skipped++;
+		return -1;
+	}
+
+	for (c = ss7->calls; c; c = c->next)
+		n++;
+
+	if (n > slot->size) {
+		tmp = realloc(slot->calls, n * sizeof(*tmp));
+		if (!tmp) {
+			ss7_error(ss7, "Unable to allocate call snapshot\n");
+			return -1;
+		}
+		slot->calls = tmp;
+		slot->size = n;
+	}
+
+	gettimeofday(&now, NULL);
+
+	for (c = ss7->calls, info = slot->calls; c; c = c->next, info++) {
+		info->cic = c->cic;
+		info->dpc = c->dpc;
+		info->sls = c->sls;
+		info->got_sent_msg = c->got_sent_msg;
+		info->cause = c->cause;
+		info->timers = 0;
+		info->next_timer = -1;
+		for (x = 0; x < ISUP_MAX_TIMERS; x++) {
+			if (c->timer[x] < 0)
+				continue;
+			info->timers |= 1ULL << x;
+			ms = ss7_tvdiff_usec(&ss7->ss7_sched[c->timer[x]].when, &now) / 1000;
+			if (ms < 0)
+				ms = 0;
+			if (info->next_timer < 0 || ms < info->next_timer)
+				info->next_timer = ms;
+		}
+	}
+	slot->count = n;
+
+	/* Contents first, then switch readers over */
+	__sync_synchronize();
+	snap->current = s;
+	__sync_synchronize();
+
+	return 0;
+}
+
+static void isup_call_snapshot_timer(void *data)
+{
+	struct ss7 *ss7 = data;
+
+	isup_snapshot_calls(ss7);
+	ss7->call_snapshot->sched = ss7_schedule_event(ss7, ss7->call_snapshot->interval, isup_call_snapshot_timer, ss7);
+}
+
+int isup_publish_calls(struct ss7 *ss7, int interval)
+{
+	struct isup_call_snapshot *snap;
+
+	if (!ss7)
+		return -1;
+
+	if (!ss7->call_snapshot) {
+		if (interval <= 0)
+			return 0;
+		snap = calloc(1, sizeof(*snap));
+		if (!snap)
+			return -1;
+		snap->current = -1;
+		snap->sched = -1;
+		ss7->call_snapshot = snap;
+	}
+	snap = ss7->call_snapshot;
+
+	ss7_schedule_del(ss7, &snap->sched);
+	snap->interval = interval;
+	if (interval <= 0)
+		return 0;
+
+	isup_snapshot_calls(ss7);
+	snap->sched = ss7_schedule_event(ss7, interval, isup_call_snapshot_timer, ss7);
+
+	return 0;
+}
+
+static int isup_snapshot_get(struct isup_call_snapshot *snap, unsigned int dpc, int startcic, int endcic, unsigned int state_mask, struct isup_call_info *out, int max)
+{
+	struct isup_call_slot *slot;
+	struct isup_call_info *info;
+	int s, i, res = 0;
+
+	if (!snap)
+		return -1;
+
+	/* Pin the current slot; if the linkset switched meanwhile drop it and retry */
+	for (;;) {
+		s = snap->current;
+		if (s < 0)
+			return -1;
+		__sync_fetch_and_add(&snap->slot[s].refs, 1);
+		if (snap->current == s)
+			break;
+		__sync_fetch_and_sub(&snap->slot[s].refs, 1);
+	}
+
+	slot = &snap->slot[s];
+	for (i = 0; i < slot->count && res < max; i++) {
+		info = &slot->calls[i];
+		if (dpc != ISUP_ANY_DPC && info->dpc != dpc)
+			continue;
+		if (info->cic < startcic || info->cic > endcic)
+			continue;
+		if (state_mask && !(info->got_sent_msg & state_mask))
+			continue;
+		out[res++] = *info;
+	}
+
+	__sync_fetch_and_sub(&slot->refs, 1);
+
+	return res;
+}
+
+int isup_get_calls(struct ss7 *ss7, unsigned int dpc, int startcic, int endcic, unsigned int state_mask, struct isup_call_info *out, int max)
+{
+	int i, n, res = 0, published = 0;
+
+	if (!ss7 || !out)
+		return -1;
+
+	/* Each shard publishes the calls it owns */
+	for (i = 0; i < isup_instances(ss7); i++) {
+		n = isup_snapshot_get(isup_instance(ss7, i)->call_snapshot, dpc, startcic, endcic, state_mask, out + res, max - res);
+		if (n < 0)
+			continue;
+		res += n;
+		published = 1;
+	}
+
+	return published ? res : -1;
+}
+
+void isup_free_call_snapshot(struct ss7 *ss7)
+{
+	struct isup_call_snapshot *snap = ss7->call_snapshot;
+
+	if (!snap)
+		return;
+
+	ss7->call_snapshot = NULL;
+	free(snap->slot[0].calls);
+	free(snap->slot[1].calls);
+	free(snap);
+}
+
 int isup_show_calls(struct ss7 *ss7, void (* cust_printf)(int fd, const char *format, ...), int fd)
 {
 	struct isup_call *c = ss7->calls;
@@ -4777,6 +5588,12 @@ static int isup_timer2str(int timer, char *res)
 		case ISUP_TIMER_T27:
 			strcpy (res, "t27");
 			return 4;
+		case ISUP_TIMER_T29:
+			strcpy (res, "t29");
+			return 4;
+		case ISUP_TIMER_T30:
+			strcpy (res, "t30");
+			return 4;
 		case ISUP_TIMER_T33:
 			strcpy (res, "t33");
 			return 4;
@@ -4832,6 +5649,10 @@ int ss7_set_isup_timer(struct ss7 *ss7, char *name, int ms)
 		ss7->isup_timers[ISUP_TIMER_T23] = ms;
 	else if (!strcasecmp(name, "t27"))
 		ss7->isup_timers[ISUP_TIMER_T27] = ms;
+	else if (!strcasecmp(name, "t29"))
+		ss7->isup_timers[ISUP_TIMER_T29] = ms;
+	else if (!strcasecmp(name, "t30"))
+		ss7->isup_timers[ISUP_TIMER_T30] = ms;
 	else if (!strcasecmp(name, "t33"))
 		ss7->isup_timers[ISUP_TIMER_T33] = ms;
 	else if (!strcasecmp(name, "t35"))
@@ -4864,6 +5685,9 @@ static void isup_timer_expiry(void *data)
 
 	param->c->timer[param->timer] = -1;
 
+	if (param->timer < ISUP_STATS_MAX_TIMERS)
+		ISUP_COUNT(param->ss7, param->c->dpc, timer_expiries[param->timer]);
+
 	switch (param->timer) {
 		case ISUP_TIMER_T1:
 			isup_send_message(param->ss7, param->c, ISUP_REL, rel_params);
@@ -4957,7 +5781,7 @@ static void isup_timer_expiry(void *data)
 			isup_rel(param->ss7, param->c, 28);
 			break;
 		case ISUP_TIMER_DIGITTIMEOUT:
-			e = ss7_next_empty_event(param->ss7);
+			e = isup_next_event(param->ss7, param->c);
 			if (!e) {
 				ss7_call_null(param->ss7, param->c, 1);
 				isup_free_call(param->ss7, param->c);
@@ -139,6 +139,7 @@
 #define ISUP_PARM_INR_IND 0x0e
 #define ISUP_PARM_SUBSEQUENT_NUMBER 0x05
 #define ISUP_CONNECTED_NUMBER 0x21
+#define ISUP_PARM_AUTO_CONG_LEVEL 0x27
 
 /* ISUP TIMERS  */
 #define ISUP_TIMER_T1 1
@@ -160,6 +161,8 @@
 #define ISUP_TIMER_T22 22
 #define ISUP_TIMER_T23 23
 #define ISUP_TIMER_T27 27
+#define ISUP_TIMER_T29 29
+#define ISUP_TIMER_T30 30
 #define ISUP_TIMER_T33 33
 #define ISUP_TIMER_T35 35
 
@@ -244,6 +247,8 @@ struct isup_call {
 	int cause;
 	int causecode;
 	int causeloc;
+	unsigned char acl;	/* automatic congestion level of REL, 0 if none */
+	int overload_rel;	/* released by us in overload, the RLC is ours */
 	int cot_check_passed;
 	int cot_check_required;
 	int cot_performed_on_previous_cic;
@@ -274,6 +279,24 @@ struct isup_call {
 	unsigned char interworking_indicator;
 	unsigned char forward_indicator_pmbits;
 	int timer[ISUP_MAX_TIMERS];
+	/* Start of the pending procedures, for the latency histograms */
+	struct timeval lat_iam;
+	struct timeval lat_rel;
+	struct timeval lat_grs;
+	struct timeval lat_blo;
+};
+
+/* What we keep per destination */
+struct isup_dpc {
+	unsigned int dpc;
+	struct isup_stats stats;
+	struct isup_latency latency;
+	/* Automatic congestion level received, with the time of the last
+	 * change (T29 and T30 run from there) and its call gapping */
+	int acl;
+	struct timeval acl_time;
+	struct ss7_bucket gap;
+	struct isup_dpc *next;
 };
 
 int isup_receive(struct ss7 *ss7, struct mtp2 *sl, struct routing_label *rl, unsigned char *sif, int len);
@@ -281,4 +304,30 @@ int isup_receive(struct ss7 *ss7, struct mtp2 *sl, struct routing_label *rl, uns
 int isup_dump(struct ss7 *ss7, struct mtp2 *sl, unsigned char *sif, int len);
 
 void isup_free_all_calls(struct ss7 *ss7);
+
+void isup_free_all_dpcs(struct ss7 *ss7);
+
+/* Call table copies for readers in other threads, the linkset fills the
+ * slot not in use while readers hold a reference on the current one */
+struct isup_call_slot {
+	struct isup_call_info *calls;
+	int count;
+	int size;
+	volatile int refs;
+};
+
+struct isup_call_snapshot {
+	volatile int current;		/* slot readers use, -1 before the first copy */
+	int interval;
+	int sched;
+	unsigned long skipped;		/* copies skipped because a reader held the slot */
+	struct isup_call_slot slot[2];
+};
+
+void isup_free_call_snapshot(struct ss7 *ss7);
+
+/* Adds a call from isup_new_call_nolink() to the linkset */
+void isup_link_call(struct ss7 *ss7, struct isup_call *c);
+
+char * isup_message2str(unsigned char message);
 #endif /* _SS7_ISUP_H */
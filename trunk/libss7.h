@@ -72,6 +72,12 @@
 
 #define ISUP_EVENT_DIGITTIMEOUT 35
 
+/* A link changed congestion level, see ss7_set_congestion_thresholds() */
+#define SS7_EVENT_CONGESTION	36
+
+/* Route set congestion status of a DPC changed, signalled by TFC */
+#define SS7_EVENT_DPC_CONGESTION	37
+
 /* ISUP MSG Flags */
 #define ISUP_SENT_GRS (1 << 0)
 #define ISUP_SENT_CGB (1 << 1)
@@ -176,6 +182,203 @@
 struct ss7;
 struct isup_call;
 
+/* ISUP counters of a linkset or of one DPC, see isup_get_stats() */
+#define ISUP_STATS_MAX_TIMERS	64
+
+struct isup_stats {
+	unsigned int dpc;
+	unsigned long msg_tx[256];		/* indexed by ISUP message type */
+	unsigned long msg_rx[256];
+	unsigned long rel_cause_tx[128];	/* indexed by cause value */
+	unsigned long rel_cause_rx[128];
+	unsigned long timer_expiries[ISUP_STATS_MAX_TIMERS];	/* indexed by ISUP_TIMER_* */
+	unsigned long unexpected;		/* messages handled by the unexpected message procedure */
+	unsigned long dual_seizures;
+	unsigned long event_drops;		/* events lost because the event queue was full */
+	unsigned long acl_rx;			/* RELs received with an automatic congestion level */
+	unsigned long gapped;			/* outgoing IAMs refused by call gapping */
+	unsigned long overload_rels;		/* incoming IAMs released with cause 42 in overload */
+};
+
+/* Histogram of intervals in microseconds, bucket n (n > 0) counts the values
+ * from 2^(n-1) up to 2^n - 1, the last bucket everything above */
+#define SS7_HIST_BUCKETS	28
+
+struct ss7_hist {
+	unsigned long count;
+	unsigned long long sum;		/* usec */
+	unsigned long max;		/* usec */
+	unsigned long bucket[SS7_HIST_BUCKETS];
+};
+
+/* ISUP procedure latencies, see isup_get_latency() */
+#define ISUP_LAT_IAM_ACM	0	/* IAM sent, ACM (or CON) received */
+#define ISUP_LAT_IAM_ANM	1	/* IAM sent, ANM (or CON) received */
+#define ISUP_LAT_REL_RLC	2
+#define ISUP_LAT_GRS_GRA	3
+#define ISUP_LAT_BLO_BLA	4
+#define ISUP_LAT_IN_IAM_ACM	5	/* IAM received, we sent ACM (or CON) */
+#define ISUP_LAT_IN_IAM_ANM	6
+#define ISUP_LAT_IN_REL_RLC	7
+#define ISUP_LAT_IN_GRS_GRA	8
+#define ISUP_LAT_IN_BLO_BLA	9
+#define ISUP_LAT_MAX		10
+
+struct isup_latency {
+	unsigned int dpc;
+	struct ss7_hist proc[ISUP_LAT_MAX];	/* indexed by ISUP_LAT_* */
+};
+
+/* Scheduler health, see ss7_get_sched_stats() */
+struct ss7_sched_stats {
+	unsigned long runs;		/* ss7_schedule_run() calls */
+	unsigned long callbacks;	/* timers fired */
+	unsigned int max_callbacks;	/* most timers fired in one run */
+	unsigned long late_warnings;
+	struct ss7_hist lateness;	/* usec between 'when' and its callback starting */
+};
+
+/* CPU cost per layer, see ss7_get_profile().  Only collected when libss7 is
+ * built with SS7_PROFILE; time spent in a nested layer is not counted again
+ * in the layer that called it. */
+#define SS7_PROF_MTP2_RX	0
+#define SS7_PROF_MTP2_TX	1
+#define SS7_PROF_MTP3_RX	2
+#define SS7_PROF_NET_MNG	3
+#define SS7_PROF_ROUTING	4	/* rl_to_link() */
+#define SS7_PROF_ISUP_DECODE	5
+#define SS7_PROF_ISUP_ENCODE	6
+#define SS7_PROF_APP		7	/* application callbacks */
+#define SS7_PROF_LAYERS		8
+
+struct ss7_prof_entry {
+	unsigned long calls;
+	unsigned long long ticks;
+	unsigned long long max;
+};
+
+struct ss7_profile {
+	int tsc;				/* ticks are CPU cycles, otherwise nanoseconds */
+	struct ss7_prof_entry layer[SS7_PROF_LAYERS];
+	struct ss7_prof_entry isup_decode[256];	/* indexed by ISUP message type */
+	struct ss7_prof_entry isup_encode[256];
+};
+
+/* Call summary as published for other threads, see isup_get_calls() */
+#define ISUP_ANY_DPC		0xffffffff
+
+struct isup_call_info {
+	int cic;
+	unsigned int dpc;
+	unsigned char sls;
+	unsigned int got_sent_msg;	/* ISUP_SENT_* and ISUP_GOT_* flags */
+	int cause;
+	unsigned long long timers;	/* bit n set while ISUP timer n runs */
+	long next_timer;		/* ms until the first running timer expires, -1 if none */
+};
+
+/* Commands queued to the protocol thread, see ss7_thread_start() */
+#define SS7_CMD_START		0	/* ss7_start() */
+#define SS7_CMD_IAM		1	/* call, cic, dpc */
+#define SS7_CMD_ACM		2	/* call */
+#define SS7_CMD_ANM		3	/* call */
+#define SS7_CMD_CON		4	/* call */
+#define SS7_CMD_CPG		5	/* call, event */
+#define SS7_CMD_REL		6	/* call, cause */
+#define SS7_CMD_RLC		7	/* call */
+#define SS7_CMD_FREE		8	/* call, isup_free_call() */
+#define SS7_CMD_GRS		9	/* cic, endcic, dpc */
+#define SS7_CMD_CGB		10	/* cic, endcic, dpc, state, type */
+#define SS7_CMD_CGU		11	/* cic, endcic, dpc, state, type */
+#define SS7_CMD_BLO		12	/* cic, dpc */
+#define SS7_CMD_UBL		13	/* cic, dpc */
+#define SS7_CMD_RSC		14	/* cic, dpc */
+#define SS7_CMD_FUNC		15	/* func(ss7, data), on the shard of call or cic, dpc */
+
+struct ss7_cmd {
+	int cmd;
+	struct isup_call *call;
+	int cic;
+	int endcic;
+	unsigned int dpc;
+	int cause;
+	int event;
+	int type;
+	unsigned char state[255];
+	void (*func)(struct ss7 *ss7, void *data);
+	void *data;
+};
+
+/* Per signalling link measurements, returned by ss7_get_link_stats() */
+struct ss7_link_stats {
+	int slc;
+	unsigned int adjpc;
+	int inservice;			/* MTP2 currently in service */
+	unsigned long msu_tx;		/* new MSUs, retransmissions not included */
+	unsigned long msu_rx;
+	unsigned long long octets_tx;	/* SIO and SIF octets of those MSUs */
+	unsigned long long octets_rx;
+	unsigned long fisu_tx;
+	unsigned long fisu_rx;
+	unsigned long lssu_tx;
+	unsigned long lssu_rx;
+	unsigned long retransmitted;	/* MSUs sent again on a retransmission request */
+	unsigned long nack_tx;		/* retransmission requests we sent */
+	unsigned long nack_rx;		/* retransmission requests from the far end */
+	unsigned long t7_expiries;
+	unsigned long align_attempts;
+	unsigned long align_failures;
+	unsigned long changeovers;
+	unsigned long changebacks;
+	unsigned long inservice_time;	/* seconds in service during the period */
+	unsigned long period;		/* seconds since the counters were reset */
+	unsigned int tx_q_depth;	/* MSUs waiting for transmission */
+	unsigned int tx_buf_depth;	/* MSUs waiting for acknowledgement */
+	double occupancy_tx;		/* MSU load in Erlang, 64 kbit/s link */
+	double occupancy_rx;
+	unsigned long tx_buf_age;	/* ms the oldest unacknowledged MSU is waiting */
+	struct ss7_hist queue_delay;	/* handed to MTP2 until first transmitted */
+	struct ss7_hist ack_rtt;	/* first transmitted until acknowledged */
+	unsigned long ls_msus;		/* ISUP MSUs load shared onto the link */
+	unsigned int sls_codes;		/* SLS values currently mapped to the link */
+	unsigned long relayed;		/* MSUs received for other point codes and relayed */
+	unsigned long screened;		/* MSUs dropped by gateway screening */
+	unsigned int cong_level;	/* congestion level of the link, 0 to 3 */
+	unsigned long cong_onsets;	/* rises of the congestion level */
+	unsigned long cong_discards;	/* MSUs discarded under congestion */
+};
+
+/* Layout of the shared memory statistics, see ss7_shm_start().  'seq' is
+ * odd while the linkset updates the region. */
+#define SS7_SHM_MAGIC		0x53533753
+#define SS7_SHM_VERSION		6
+#define SS7_SHM_MAX_LINKS	16
+
+struct ss7_shm_link {
+	char mtp2_state[24];
+	int mtp3_up;
+	int inhibited;
+	struct ss7_link_stats stats;
+};
+
+struct ss7_shm {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int size;		/* sizeof(struct ss7_shm) */
+	volatile unsigned int seq;
+	unsigned int updates;
+	long updated_sec;
+	long updated_usec;
+	unsigned int pc;
+	int state;			/* linkset up */
+	unsigned int calls;		/* ISUP call structures in use */
+	unsigned int event_queue;	/* events not yet taken by ss7_check_event() */
+	int numlinks;
+	struct ss7_shm_link links[SS7_SHM_MAX_LINKS];
+	struct ss7_sched_stats sched;
+	struct isup_stats isup;
+};
+
 typedef struct {
 	int e;
 	int cic;
@@ -242,6 +445,7 @@ typedef struct {
 	unsigned int opc;
 	unsigned long got_sent_msg;
 	struct isup_call *call;
+	int acl;		/* automatic congestion level, 0 if none */
 } ss7_event_rel;
 
 typedef struct {
@@ -342,6 +546,18 @@ typedef struct {
 	struct mtp2 *link;
 } ss7_event_link;
 
+typedef struct {
+	int e;
+	int slc;
+	int level;		/* 0 once the congestion abated */
+} ss7_event_congestion;
+
+typedef struct {
+	int e;
+	unsigned int dpc;
+	int level;		/* 0 once the congestion abated */
+} ss7_event_dpc_congestion;
+
 typedef struct {
 	int e;
 	int cic;
@@ -397,6 +613,8 @@ typedef union {
 	int e;
 	ss7_event_generic gen;
 	ss7_event_link link;
+	ss7_event_congestion cong;
+	ss7_event_dpc_congestion dpccong;
 	ss7_event_iam iam;
 	ss7_event_cicrange grs;
 	ss7_event_cicrange cqm;
@@ -428,6 +646,24 @@ typedef union {
 	ss7_event_digittimout digittimeout;
 } ss7_event;
 
+/* Callbacks of one linkset.  The ss7_set_message() style functions below only
+ * seed the callbacks of linksets created by later ss7_new() calls;
+ * ss7_set_callbacks() replaces them for one linkset.  Apart from those
+ * defaults linksets share no mutable state, each may run in its own thread. */
+struct ss7_callbacks {
+	void (*message)(struct ss7 *ss7, char *message);
+	void (*error)(struct ss7 *ss7, char *message);
+	void (*notinservice)(struct ss7 *ss7, int cic, unsigned int dpc);
+	int (*hangup)(struct ss7 *ss7, int cic, unsigned int dpc, int cause, int do_hangup);
+	void (*call_null)(struct ss7 *ss7, struct isup_call *c, int lock);
+};
+
+void ss7_set_callbacks(struct ss7 *ss7, const struct ss7_callbacks *cb);
+
+void ss7_set_userdata(struct ss7 *ss7, void *data);
+
+void * ss7_get_userdata(struct ss7 *ss7);
+
 void ss7_set_message(void (*func)(struct ss7 *ss7, char *message));
 
 void ss7_set_error(void (*func)(struct ss7 *ss7, char *message));
@@ -445,10 +681,148 @@ int ss7_schedule_run(struct ss7 *ss7);
 
 struct timeval *ss7_schedule_next(struct ss7 *ss7);
 
+/* Layer profile; -1 if libss7 was built without SS7_PROFILE */
+int ss7_get_profile(struct ss7 *ss7, struct ss7_profile *prof, int reset);
+
+/* Statistics in shared memory.  ss7_shm_start() creates the POSIX shared
+ * memory object 'name' (e.g. "/ss7-linkset1") and refreshes it from the
+ * scheduler every 'interval' ms; monitors use ss7_shm_attach() and take
+ * consistent copies with ss7_shm_read() without involving the linkset. */
+int ss7_shm_start(struct ss7 *ss7, const char *name, int interval);
+
+void ss7_shm_publish(struct ss7 *ss7);
+
+void ss7_shm_stop(struct ss7 *ss7);
+
+const struct ss7_shm * ss7_shm_attach(const char *name);
+
+void ss7_shm_detach(const struct ss7_shm *shm);
+
+int ss7_shm_read(const struct ss7_shm *shm, struct ss7_shm *copy);
+
+const char * ss7_prof_layer2str(int layer);
+
+/* Timer lateness measurements; with 'reset' set they start over once copied */
+int ss7_get_sched_stats(struct ss7 *ss7, struct ss7_sched_stats *stats, int reset);
+
+/* Report timers firing more than 'ms' late through the error callback, 0 disables */
+void ss7_set_sched_warning(struct ss7 *ss7, unsigned int ms);
+
+/* Protocol thread.  ss7_thread_start() runs the links, the scheduler and
+ * the event queue of a started linkset on a thread of its own.  From then
+ * on other threads only talk to the linkset through ss7_thread_command(),
+ * which never blocks and may be used by any number of threads, and
+ * ss7_thread_event(), which may be used by one thread and returns 1 with a
+ * copy of the next event or 0 if there is none.  ss7_thread_event_fd()
+ * polls readable while events are pending.  Calls for SS7_CMD_IAM come from
+ * isup_new_call_nolink(); after a command was queued for a call the
+ * application must not touch it anymore.  Callbacks, including
+ * 'link_event' for POLLPRI on a link, run on the protocol thread. */
+int ss7_thread_start(struct ss7 *ss7, unsigned int events, void (*link_event)(struct ss7 *ss7, int fd));
+
+void ss7_thread_stop(struct ss7 *ss7);
+
+int ss7_thread_command(struct ss7 *ss7, const struct ss7_cmd *cmd);
+
+int ss7_thread_event(struct ss7 *ss7, ss7_event *e);
+
+int ss7_thread_event_fd(struct ss7 *ss7);
+
+/* ISUP shards.  With 'shards' > 1, set before ss7_thread_start(), ISUP
+ * runs on that many threads besides the MTP2/MTP3 one.  Each shard owns
+ * the calls and ISUP timers of the CICs hashed to it by point code and
+ * block of 'block' CICs, so messages and commands of one CIC keep their
+ * order.  A 'block' of 0 means 32 for E1 systems (0-31, 32-63, ...), T1
+ * systems (0-23, 24-47, ...) want 24.  Callbacks get the shard, use
+ * ss7_get_userdata() to find the linkset.  Circuit group messages (GRS,
+ * CGB, CGU, CQM and their answers) with a range crossing a block are
+ * refused, sent or received.
+ * SS7_CMD_FUNC runs on the shard of 'call', or of 'dpc' and 'cic' when
+ * 'dpc' is set, otherwise on the linkset.  The ISUP counters, latencies,
+ * congestion levels, call snapshots and shared memory statistics of the
+ * linkset add up its shards and resetting them resets the shards; call
+ * isup_publish_calls() before ss7_thread_start() for the shards to publish. */
+int ss7_set_isup_shards(struct ss7 *ss7, int shards, int block);
+
+/* MTP2 thread.  Set before ss7_start() on a linkset to be run by
+ * ss7_thread_start(): the links and T1-T7 then get a thread of their own,
+ * received MSUs are queued to the protocol thread, which gives the links
+ * back to MTP2 after every command and MSU, so a burst of ISUP work cannot
+ * hold up FISUs and acknowledgements.  'link_event' runs on the MTP2 thread.
+ * Until the thread starts, ss7_schedule_run() runs T1-T7 as before. */
+int ss7_set_mtp2_thread(struct ss7 *ss7);
+
 int ss7_add_link(struct ss7 *ss7, int transport, int fd);
 
 int ss7_set_adjpc(struct ss7 *ss7, int fd, unsigned int pc);
 
+/* Combined linksets.  Routes 'dpc' over the adjacent SP 'adjpc' of this
+ * linkset with 'priority', 0 being the highest; a negative priority removes
+ * the route.  ISUP traffic to a destination with routes is load shared by
+ * SLS over the links of the adjacent SPs with the best priority whose route
+ * is not prohibited, and moves to the next priority when they all fail.
+ * Destinations without routes keep being shared over every link. */
+int ss7_set_route(struct ss7 *ss7, unsigned int dpc, unsigned int adjpc, int priority);
+
+/* Signalling transfer point.  MSUs received on this linkset for 'dpc' are
+ * relayed over linkset 'out', which may be this one, and go out on the link
+ * its routes and SLS map give; NULL stops relaying 'dpc'.  Frames read by
+ * ss7_read() are handed to the outgoing link without being copied.  Both
+ * linksets must be run by the same thread, or by ss7_thread_start(). */
+int ss7_set_relay(struct ss7 *ss7, unsigned int dpc, struct ss7 *out);
+
+/* Congestion levels 1 to 3 of the link transmit queues, Q.704 national
+ * option.  A link enters 'level' when its queue holds 'onset' MSUs and
+ * leaves it below 'abate', which is 1 or more; past 'discard' MSUs of a
+ * lower priority are thrown away (ITU: network management 3, ISUP 1, IAM 0).
+ * Changeover and route buffers stop at the level 3 discard threshold.  Level
+ * changes are reported with SS7_EVENT_CONGESTION, and while any in service
+ * link of the linkset is congested isup_iam() fails with -2.  A link leaving
+ * service drops back to level 0.  Disabled until level 1 is set. */
+int ss7_set_congestion_thresholds(struct ss7 *ss7, int level, unsigned int onset, unsigned int abate, unsigned int discard);
+
+/* Highest congestion level of the links, 0 when none is congested */
+int ss7_get_congestion(struct ss7 *ss7);
+
+/* Signalling route set congestion, Q.704 13.9.  A TFC sets the congestion
+ * status of its DPC (1 when it carries none) and MSUs of a lower priority
+ * towards it are dropped, so isup_iam() fails with -2 there.  The status
+ * is tested with RCT after T15 and lowered by one each T16 without a new
+ * TFC, 3 and 2 seconds unless set with ss7_set_mtp3_timer().  Changes are
+ * reported with SS7_EVENT_DPC_CONGESTION. */
+int ss7_get_dpc_congestion(struct ss7 *ss7, unsigned int dpc);
+
+/* Gateway screening of the MSUs received on a linkset, before they are
+ * taken or relayed.  The first rule matching OPC, DPC, service indicator
+ * and, for ISUP, CIC decides, otherwise the default action (allow).  Rules
+ * are compiled so every MSU costs the same whatever their number; set them
+ * before ss7_thread_start(). */
+#define SS7_SCREEN_ALLOW	0
+#define SS7_SCREEN_DENY		1
+
+#define SS7_SCREEN_MAX_RULES	64
+
+struct ss7_screen_rule {
+	unsigned int opc_min;
+	unsigned int opc_max;
+	unsigned int dpc_min;
+	unsigned int dpc_max;
+	unsigned int si_mask;	/* 1 << service indicator, 0 for all */
+	int cic_min;		/* -1 for any CIC and for every SI */
+	int cic_max;
+	int action;
+};
+
+/* Returns the number of the rule, -1 on error */
+int ss7_screen_add(struct ss7 *ss7, const struct ss7_screen_rule *rule);
+
+int ss7_screen_default(struct ss7 *ss7, int action);
+
+/* MSUs matched by 'rule', or by the default action with -1 */
+unsigned long ss7_screen_hits(struct ss7 *ss7, int rule);
+
+void ss7_screen_clear(struct ss7 *ss7);
+
 int ss7_set_network_ind(struct ss7 *ss7, int ni);
 
 int ss7_set_pc(struct ss7 *ss7, unsigned int pc);
@@ -487,15 +861,73 @@ int ss7_pollflags(struct ss7 *ss7, int fd);
 
 int ss7_set_mtp3_timer(struct ss7 *ss7, char *name, int ms);
 
+/* Link measurements.  'slc' selects the link, ss7_get_linkset_stats() adds
+ * up all links of the linkset. */
+int ss7_get_link_stats(struct ss7 *ss7, int slc, struct ss7_link_stats *stats);
+
+int ss7_get_linkset_stats(struct ss7 *ss7, struct ss7_link_stats *stats);
+
+void ss7_reset_link_stats(struct ss7 *ss7);
+
+/* MSU capture to a pcap file (Wireshark MTP2 with pseudo header).  Frames are
+ * copied into a ring of 'frames' entries by the protocol thread and only
+ * written out by ss7_capture_flush(), which may be called from another thread. */
+int ss7_capture_start(struct ss7 *ss7, const char *filename, unsigned int frames);
+
+void ss7_capture_enable(struct ss7 *ss7, int enable);
+
+int ss7_capture_flush(struct ss7 *ss7);
+
+unsigned int ss7_capture_dropped(struct ss7 *ss7);
+
+/* Flushes and closes the capture, call it from the protocol thread.  It
+ * waits for a ss7_capture_flush() running on another thread to return,
+ * later calls return -1. */
+void ss7_capture_stop(struct ss7 *ss7);
+
+/* Deferred debug tracing.  While started, signal units selected by the
+ * debug flags are only recorded in a ring of 'frames' entries; they are
+ * decoded and passed to the message callback by ss7_trace_process(), which
+ * may run on another thread.  'max' limits the records decoded per call,
+ * 0 decodes everything pending. */
+int ss7_trace_start(struct ss7 *ss7, unsigned int frames);
+
+int ss7_trace_process(struct ss7 *ss7, int max);
+
+/* Decodes what is left and stops tracing, call it from the protocol thread.
+ * It waits for a ss7_trace_process() running on another thread to return,
+ * later calls return -1. */
+void ss7_trace_stop(struct ss7 *ss7);
+
 /* ISUP call related message functions */
 
 int ss7_set_isup_timer(struct ss7 *ss7, char *name, int ms);
 
+/* Automatic congestion control, Q.764 2.11.  A REL carrying an automatic
+ * congestion level puts its OPC at that level; another one within T29
+ * (300ms) is ignored and each T30 (5s) without one lowers it by one.
+ * Outgoing IAMs are gapped by token buckets of 'rate' calls per second
+ * and up to 'burst' calls at once: level 0 for all IAMs of the linkset,
+ * 1 and 2 for each DPC at that level.  A gapped isup_iam() fails with -2.
+ * A rate of 0, the default, does not limit.  With ISUP shards each one
+ * lets through its share of the rate and burst, but at least one call at
+ * once, so the linkset as a whole keeps to them. */
+int ss7_set_call_gapping(struct ss7 *ss7, int level, unsigned int rate, unsigned int burst);
+
+/* Automatic congestion level of 'dpc', 0 when not congested */
+int isup_get_acl(struct ss7 *ss7, unsigned int dpc);
+
+/* Inbound overload.  With 'level1' events or more waiting for the
+ * application (level 2 from 'level2') incoming IAMs are released with
+ * cause 42 and the RELs we send carry our congestion level.  0 disables. */
+int ss7_set_isup_overload(struct ss7 *ss7, unsigned int level1, unsigned int level2);
+
 struct isup_call * isup_free_call_if_clear(struct ss7 *ss7, struct isup_call *c);
 
 void isup_start_digittimeout(struct ss7 *ss7, struct isup_call *c);
 
-/* Send an IAM */
+/* Send an IAM.  -2 while the linkset is congested, the call is freed as
+ * on any other failure. */
 int isup_iam(struct ss7 *ss7, struct isup_call *c);
 
 int isup_inr(struct ss7 *ss7, struct isup_call *c, unsigned char ind0, unsigned char ind1);
@@ -508,6 +940,9 @@ int isup_con(struct ss7 *ss7, struct isup_call *c);
 
 struct isup_call * isup_new_call(struct ss7 *ss7);
 
+/* A call not yet known to the linkset, see ss7_thread_start() */
+struct isup_call * isup_new_call_nolink(struct ss7 *ss7);
+
 int isup_acm(struct ss7 *ss7, struct isup_call *c);
 
 int isup_faa(struct ss7 *ss7, struct isup_call *c);
@@ -629,8 +1064,39 @@ void isup_set_callref(struct isup_call *c, unsigned int call_ref_ident, unsigned
 
 /* End of call related sets */
 
+/* ISUP counters.  isup_get_stats() gives the totals of the linkset,
+ * isup_get_dpc_stats() those of one DPC (-1 if nothing was exchanged with
+ * it yet) and isup_get_dpcs() lists up to 'max' known DPCs. */
+int isup_get_stats(struct ss7 *ss7, struct isup_stats *stats);
+
+int isup_get_dpc_stats(struct ss7 *ss7, unsigned int dpc, struct isup_stats *stats);
+
+int isup_get_dpcs(struct ss7 *ss7, unsigned int *dpcs, int max);
+
+void isup_reset_stats(struct ss7 *ss7);
+
+/* ISUP procedure latency histograms, totals of the linkset or of one DPC.
+ * With 'reset' set the histograms are cleared once copied. */
+int isup_get_latency(struct ss7 *ss7, struct isup_latency *lat, int reset);
+
+int isup_get_dpc_latency(struct ss7 *ss7, unsigned int dpc, struct isup_latency *lat, int reset);
+
+void isup_reset_latency(struct ss7 *ss7);
+
+const char * isup_latency2str(int proc);
+
 int isup_show_calls(struct ss7 *ss7, void (* cust_printf)(int fd, const char *format, ...), int fd);
 
+/* Call table snapshots.  isup_publish_calls() makes the linkset copy its
+ * calls every 'interval' ms (0 stops).  isup_get_calls() may then be used
+ * from any thread, it never waits for the linkset and returns up to 'max'
+ * calls of the latest snapshot matching the DPC (or ISUP_ANY_DPC), the
+ * CIC range and, if 'state_mask' is not 0, having one of its flags set.
+ * -1 means nothing was published yet. */
+int isup_publish_calls(struct ss7 *ss7, int interval);
+
+int isup_get_calls(struct ss7 *ss7, unsigned int dpc, int startcic, int endcic, unsigned int state_mask, struct isup_call_info *out, int max);
+
 void ss7_show_linkset(struct ss7 *ss7, void (* cust_printf)(int fd, const char *format, ...), int fd);
 
 /* net mng */
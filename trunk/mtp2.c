@@ -41,6 +41,12 @@
 #define mtp_error ss7_error
 #define mtp_message ss7_message
 
+/* T1-T7 run on the MTP2 thread when the linkset has one */
+static inline struct ss7 * mtp2_sched(struct mtp2 *link)
+{
+	return link->master->mtp2_timers ? link->master->mtp2_timers : link->master;
+}
+
 int len_buf(struct ss7_msg *buf)
 {
 	int res = 0;
@@ -132,6 +138,7 @@ void flush_bufs(struct mtp2 *link)
 	list = link->tx_q;
 
 	link->tx_q = NULL;
+	mtp2_tx_q_update(link);
 
 	while (list) {
 		cur = list;
@@ -161,28 +168,128 @@ static void reset_mtp(struct mtp2 *link)
 static void mtp2_request_retransmission(struct mtp2 *link)
 {
 	link->retransmissioncount++;
+	link->stats.nack_tx++;
 	link->curbib = !link->curbib;
 	link->flags |= MTP2_FLAG_WRITE;
 }
 
+static inline int mtp2_tx_class(struct ss7_msg *m)
+{
+	unsigned char userpart = m->buf[MTP2_SIZE] & 0xf;
+
+	if (userpart == SIG_NET_MNG)
+		return MTP2_TX_NET_MNG;
+	if (userpart == SIG_STD_TEST || userpart == SIG_SPEC_TEST)
+		return MTP2_TX_TEST;
+
+	return MTP2_TX_USER;
+}
+
+/* Strict priority without reordering a class: the MSU goes right behind
+ * the last one of its own or a higher class */
 static int mtp2_queue_su(struct mtp2 *link, struct ss7_msg *m)
 {
-	struct ss7_msg *cur;
-	
-	if (!link->tx_q) {
+	struct ss7_msg *prev = NULL;
+	int class = mtp2_tx_class(m);
+	int i;
+
+	for (i = class; i >= 0 && !prev; i--)
+		prev = link->tx_q_tail[i];
+
+	if (prev) {
+		m->next = prev->next;
+		prev->next = m;
+	} else {
+		m->next = link->tx_q;
 		link->tx_q = m;
-		m->next = NULL;
-		return 0;
 	}
 
-	for (cur = link->tx_q; cur->next; cur = cur->next);
-	
-	cur->next = m;
-	m->next = NULL;
-	
+	link->tx_q_tail[class] = m;
+	link->tx_q_len++;
+
+	return 0;
+}
+
+static void mtp2_set_congestion(struct mtp2 *link, int level)
+{
+	struct ss7 *ss7 = link->master;
+	ss7_event *e;
+	int i, max = 0;
+
+	if (level > link->cong_level)
+		link->stats.cong_onsets++;
+	link->cong_level = level;
+
+	/* A link out of service carries no traffic, whatever it still holds */
+	for (i = 0; i < ss7->numlinks; i++) {
+		if (ss7->links[i]->state == MTP_INSERVICE && ss7->links[i]->cong_level > max)
+			max = ss7->links[i]->cong_level;
+	}
+	ss7->cong_level = max;
+
+	e = ss7_next_empty_event(ss7);
+	if (!e) {
+		mtp_error(ss7, "Could not queue event\n");
+		return;
+	}
+	e->cong.e = SS7_EVENT_CONGESTION;
+	e->cong.slc = link->slc;
+	e->cong.level = level;
+}
+
+/* Q.704 national option with multiple congestion levels: the status rises
+ * with the onset thresholds and MSUs of a lower priority than the discard
+ * level reached are thrown away.  Returns -1 to discard. */
+static int mtp2_congestion_check(struct mtp2 *link, struct ss7_msg *m)
+{
+	struct ss7 *ss7 = link->master;
+	unsigned int len = link->tx_q_len + 1;
+	int level = link->cong_level, discard;
+
+	for (discard = 3; discard > 0; discard--) {
+		if (ss7->cong_discard[discard] && len > ss7->cong_discard[discard])
+			break;
+	}
+	if (discard && mtp3_msu_priority(ss7, m) < discard)
+		return -1;
+
+	while (level < 3 && ss7->cong_onset[level + 1] && len >= ss7->cong_onset[level + 1])
+		level++;
+	if (level != link->cong_level)
+		mtp2_set_congestion(link, level);
+
 	return 0;
 }
 
+static void mtp2_congestion_abate(struct mtp2 *link)
+{
+	struct ss7 *ss7 = link->master;
+	int level = link->cong_level;
+
+	while (level && link->tx_q_len < ss7->cong_abate[level])
+		level--;
+	if (level != link->cong_level)
+		mtp2_set_congestion(link, level);
+}
+
+/* For whoever took MSUs out of tx_q */
+void mtp2_tx_q_update(struct mtp2 *link)
+{
+	struct ss7_msg *cur;
+	unsigned int len = 0;
+
+	memset(link->tx_q_tail, 0, sizeof(link->tx_q_tail));
+
+	for (cur = link->tx_q; cur; cur = cur->next) {
+		link->tx_q_tail[mtp2_tx_class(cur)] = cur;
+		len++;
+	}
+
+	link->tx_q_len = len;
+	if (link->cong_level)
+		mtp2_congestion_abate(link);
+}
+
 static void make_lssu(struct mtp2 *link, unsigned char *buf, unsigned int *size, int lssu_status)
 {
 	struct mtp_su_head *head;
@@ -278,10 +385,11 @@ static void t7_expiry(void *data)
 	struct mtp2 *link = data;
 	ss7_error(link->master, "T7 expired on link SLC: %i ADJPC: %i\n", link->slc, link->dpc);
 	link->t7 = -1;
+	link->stats.t7_expiries++;
 	mtp2_setstate(link, MTP_IDLE);
 }
 
-int mtp2_transmit(struct mtp2 *link)
+static int __mtp2_transmit(struct mtp2 *link)
 {
 	int res = 0;
 	unsigned char *h;
@@ -301,7 +409,7 @@ int mtp2_transmit(struct mtp2 *link)
 		}
 
 		h = m->buf;
-		size = m->size;
+		size = m->size + 2;
 
 		h1 = (struct mtp_su_head *)h;
 		/* Update the FIB and BSN since they aren't the same */
@@ -315,7 +423,7 @@ int mtp2_transmit(struct mtp2 *link)
 		if (m) {
 			h = m->buf;
 			init_mtp2_header(link, (struct mtp_su_head *) h, 1, 0); /* in changeover we may manipulate the buffers!!! */
-			size = m->size;
+			size = m->size + 2;
 		} else {
 			size = sizeof(buf);
 			if (link->autotxsutype == FISU)
@@ -329,7 +437,25 @@ int mtp2_transmit(struct mtp2 *link)
 	res = write(link->fd, h, size);  /* Add 2 for FCS */
 
 	if (res > 0) {
+		if (m)
+			ss7_capture_frame(link->master, link->slc, SS7_FRAME_TX, h, size - 2);
 		mtp2_dump(link, '>', h, size - 2);
+
+		if (retransmit) {
+			link->stats.retransmitted++;
+			m->retransmitted = 1;
+		} else if (m) {
+			link->stats.msu_tx++;
+			link->stats.octets_tx += size - 2 - MTP2_SIZE;
+			m->retransmitted = 0;
+			gettimeofday(&m->sent, NULL);
+			if (timerisset(&m->queued))
+				ss7_hist_add(&link->stats.queue_delay, ss7_tvdiff_usec(&m->sent, &m->queued));
+		} else if (((struct mtp_su_head *)h)->li)
+			link->stats.lssu_tx++;
+		else
+			link->stats.fisu_tx++;
+
 		if (retransmit) {
 			/* Update our retransmit positon since it transmitted */
 			update_retransmit_pos(link);
@@ -337,10 +463,16 @@ int mtp2_transmit(struct mtp2 *link)
 			if (m) {
 				/* Advance to next MSU to be transmitted */
 				link->tx_q = m->next;
+				if (link->tx_q_tail[mtp2_tx_class(m)] == m)
+					link->tx_q_tail[mtp2_tx_class(m)] = NULL;
+				if (link->tx_q_len)
+					link->tx_q_len--;
+				if (link->cong_level)
+					mtp2_congestion_abate(link);
 				/* Add it to the tx'd message queue (MSUs that haven't been acknowledged) */
 				add_txbuf(link, m);
 				if (link->t7 == -1)
-					link->t7 = ss7_schedule_event(link->master, link->timers.t7, t7_expiry, link);
+					link->t7 = ss7_schedule_event(mtp2_sched(link), link->timers.t7, t7_expiry, link);
 			}
 		}
 
@@ -352,12 +484,31 @@ int mtp2_transmit(struct mtp2 *link)
 	return res;
 }
 
+int mtp2_transmit(struct mtp2 *link)
+{
+	int res;
+
+	SS7_PROF_ENTER(link->master);
+	res = __mtp2_transmit(link);
+	SS7_PROF_LEAVE(link->master, SS7_PROF_MTP2_TX, -1);
+
+	return res;
+}
+
 int mtp2_msu(struct mtp2 *link, struct ss7_msg *m)
 {
 	int len = m->size - MTP2_SIZE;
 	struct mtp_su_head *h = (struct mtp_su_head *) m->buf;
 
+	if (link->master->cong_onset[1] && mtp2_congestion_check(link, m)) {
+		link->stats.cong_discards++;
+		ss7_msg_free(m);
+		return -1;
+	}
+
 	link->flags |= MTP2_FLAG_WRITE;
+	if (link->master->mtp2_timers)
+		ss7_mtp2_kick(link->master);
 
 	/* init_mtp2_header(link, h, 1, 0); */
 
@@ -366,10 +517,10 @@ int mtp2_msu(struct mtp2 *link, struct ss7_msg *m)
 	else
 		h->li = len;
 
-	m->size += 2; /* For CRC */
+	/* Keep the original time of MSUs coming again from changeover or route buffers */
+	if (!timerisset(&m->queued))
+		gettimeofday(&m->queued, NULL);
 	mtp2_queue_su(link, m);
-	/* Just in case */
-	m->next = NULL;
 
 	return 0;
 }
@@ -393,6 +544,7 @@ void update_txbuf(struct mtp2 *link, struct ss7_msg **buf, unsigned char upto)
 	struct mtp_su_head *h;
 	struct ss7_msg *prev = NULL, *cur;
 	struct ss7_msg *frlist = NULL;
+	struct timeval now;
 	/* Make a list, frlist that will be the SUs to free */
 
 	/* Empty list */
@@ -418,14 +570,20 @@ void update_txbuf(struct mtp2 *link, struct ss7_msg **buf, unsigned char upto)
 	}
 
 	if (link && frlist && link->t7 > -1) {
-		ss7_schedule_del(link->master, &link->t7);
+		ss7_schedule_del(mtp2_sched(link), &link->t7);
 		if (link->tx_buf)
-			link->t7 = ss7_schedule_event(link->master, link->timers.t7, &t7_expiry, link);
+			link->t7 = ss7_schedule_event(mtp2_sched(link), link->timers.t7, &t7_expiry, link);
 	}
 	
+	if (link && frlist)
+		gettimeofday(&now, NULL);
+
 	while (frlist) {
 		cur = frlist;
 		frlist = frlist->next;
+		/* The ack of a retransmitted MSU may be for either copy */
+		if (link && !cur->retransmitted && timerisset(&cur->sent))
+			ss7_hist_add(&link->stats.ack_rtt, ss7_tvdiff_usec(&now, &cur->sent));
 		free(cur);
 	}
 
@@ -511,6 +669,17 @@ static int to_idle(struct mtp2 *link)
 	return 0;
 }
 
+static void mtp2_leave_inservice(struct mtp2 *link)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	link->inservice_usec += (now.tv_sec - link->inservice_since.tv_sec) * 1000000LL + (now.tv_usec - link->inservice_since.tv_usec);
+
+	if (link->cong_level)
+		mtp2_set_congestion(link, 0);
+}
+
 int mtp2_setstate(struct mtp2 *link, int newstate)
 {
 	ss7_event *e;
@@ -518,11 +687,16 @@ int mtp2_setstate(struct mtp2 *link, int newstate)
 	if (link->master->debug & SS7_DEBUG_MTP2)
 		mtp_message(link->master, "Link state change: %s -> %s\n", linkstate2str(link->state), linkstate2str(newstate));
 
+	if (link->state == MTP_IDLE)
+		link->stats.align_attempts++;
+	else if (newstate == MTP_IDLE && link->state != MTP_INSERVICE && link->state != MTP_ALARM)
+		link->stats.align_failures++;
+
 	switch (link->state) {
 		case MTP_ALARM:
 			return 0;
 		case MTP_IDLE:
-			link->t2 = ss7_schedule_event(link->master, link->timers.t2, t2_expiry, link);
+			link->t2 = ss7_schedule_event(mtp2_sched(link), link->timers.t2, t2_expiry, link);
 			if (mtp2_lssu(link, LSSU_SIO)) {
 				mtp_error(link->master, "Unable to transmit initial LSSU\n");
 				return -1;
@@ -530,16 +704,16 @@ int mtp2_setstate(struct mtp2 *link, int newstate)
 			link->state = MTP_NOTALIGNED;
 			return 0;
 		case MTP_NOTALIGNED:
-			ss7_schedule_del(link->master, &link->t2);
+			ss7_schedule_del(mtp2_sched(link), &link->t2);
 			switch (newstate) {
 				case MTP_IDLE:
 					return to_idle(link);
 				case MTP_ALIGNED:
 				case MTP_PROVING:
 					if (newstate == MTP_ALIGNED)
-						link->t3 = ss7_schedule_event(link->master, link->timers.t3, t3_expiry, link);
+						link->t3 = ss7_schedule_event(mtp2_sched(link), link->timers.t3, t3_expiry, link);
 					else
-						link->t4 = ss7_schedule_event(link->master, link->provingperiod, t4_expiry, link);
+						link->t4 = ss7_schedule_event(mtp2_sched(link), link->provingperiod, t4_expiry, link);
 					if (link->emergency) {
 						if (mtp2_lssu(link, LSSU_SIE)) {
 							mtp_error(link->master, "Couldn't tx LSSU_SIE\n");
@@ -556,24 +730,24 @@ int mtp2_setstate(struct mtp2 *link, int newstate)
 			link->state = newstate;
 			return 0;
 		case MTP_ALIGNED:
-			ss7_schedule_del(link->master, &link->t3);
+			ss7_schedule_del(mtp2_sched(link), &link->t3);
 
 			switch (newstate) {
 				case MTP_IDLE:
 					return to_idle(link);
 				case MTP_PROVING:
-					link->t4 = ss7_schedule_event(link->master, link->provingperiod, t4_expiry, link);
+					link->t4 = ss7_schedule_event(mtp2_sched(link), link->provingperiod, t4_expiry, link);
 			}
 			link->state = newstate;
 			return 0;
 		case MTP_PROVING:
-			ss7_schedule_del(link->master, &link->t4);
+			ss7_schedule_del(mtp2_sched(link), &link->t4);
 
 			switch (newstate) {
 				case MTP_IDLE:
 					return to_idle(link);
 				case MTP_PROVING:
-					link->t4 = ss7_schedule_event(link->master, link->provingperiod, t4_expiry, link);
+					link->t4 = ss7_schedule_event(mtp2_sched(link), link->provingperiod, t4_expiry, link);
 					break;
 				case MTP_ALIGNED:
 					if (link->emergency) {
@@ -589,7 +763,7 @@ int mtp2_setstate(struct mtp2 *link, int newstate)
 					}
 					break;
 				case MTP_ALIGNEDREADY:
-					link->t1 = ss7_schedule_event(link->master, link->timers.t1, t1_expiry, link);
+					link->t1 = ss7_schedule_event(mtp2_sched(link), link->timers.t1, t1_expiry, link);
 					if (mtp2_fisu(link, 0)) {
 						mtp_error(link->master, "Could not transmit FISU\n");
 						return -1;
@@ -599,20 +773,20 @@ int mtp2_setstate(struct mtp2 *link, int newstate)
 			link->state = newstate;
 			return 0;
 		case MTP_ALIGNEDREADY:
-			ss7_schedule_del(link->master, &link->t1);
+			ss7_schedule_del(mtp2_sched(link), &link->t1);
 			/* Our timer expired, it should be cleaned up already */
 			switch (newstate) {
 				case MTP_IDLE:
 					return to_idle(link);
 				case MTP_ALIGNEDREADY:
-					link->t1 = ss7_schedule_event(link->master, link->timers.t1, t1_expiry, link);
+					link->t1 = ss7_schedule_event(mtp2_sched(link), link->timers.t1, t1_expiry, link);
 					if (mtp2_fisu(link, 0)) {
 						mtp_error(link->master, "Could not transmit FISU\n");
 						return -1;
 					}
 					break;
 				case MTP_INSERVICE:
-					ss7_schedule_del(link->master, &link->t1);
+					ss7_schedule_del(mtp2_sched(link), &link->t1);
 					e = ss7_next_empty_event(link->master);
 					if (!e) {
 						mtp_error(link->master, "Could not queue event\n");
@@ -620,6 +794,7 @@ int mtp2_setstate(struct mtp2 *link, int newstate)
 					}
 					e->link.e = MTP2_LINK_UP;
 					e->link.link = link;
+					gettimeofday(&link->inservice_since, NULL);
 					break;
 				default:
 					mtp_error(link->master, "Don't know how to handle state change from %d to %d\n", link->state, newstate);
@@ -629,6 +804,7 @@ int mtp2_setstate(struct mtp2 *link, int newstate)
 			return 0;
 		case MTP_INSERVICE:
 			if (newstate != MTP_INSERVICE) {
+				mtp2_leave_inservice(link);
 				e = ss7_next_empty_event(link->master);
 				if (!e) {
 					mtp_error(link->master, "Could not queue event\n");
@@ -741,10 +917,15 @@ static int msu_rx(struct mtp2 *link, struct mtp_su_head *h, int len)
 
 	/* Ok, it's a valid MSU now and we can accept it */
 	link->lastfsnacked = h->fsn;
+	link->stats.msu_rx++;
+	link->stats.octets_rx += len - MTP2_SU_HEAD_SIZE;
 	/* Set write flag since we need to update the FISUs with our new BSN */
 	link->flags |= MTP2_FLAG_WRITE;
-	/* The big function */
-	res = mtp3_receive(link->master, link, h->data, len - MTP2_SU_HEAD_SIZE);
+	/* The big function, or handed to it on the protocol thread */
+	if (link->master->mtp2_timers)
+		res = ss7_mtp2_deliver(link, h->data, len - MTP2_SU_HEAD_SIZE);
+	else
+		res = mtp3_receive(link->master, link, h->data, len - MTP2_SU_HEAD_SIZE);
 
 	return res;
 }
@@ -766,6 +947,8 @@ int mtp2_stop(struct mtp2 *link)
 
 int mtp2_alarm(struct mtp2 *link)
 {
+	if (link->state == MTP_INSERVICE)
+		mtp2_leave_inservice(link);
 	link->state = MTP_ALARM;
 	return 0;
 }
@@ -790,6 +973,7 @@ struct mtp2 * mtp2_new(int fd, unsigned int switchtype)
 	new->autotxsutype = LSSU_SIOS;
 	new->lastsurxd = -1;
 	new->lastsutxd = -1;
+	gettimeofday(&new->stats_since, NULL);
 
 	if (switchtype == SS7_ITU) {
 		new->timers.t1 = ITU_TIMER_T1;
@@ -814,50 +998,74 @@ struct mtp2 * mtp2_new(int fd, unsigned int switchtype)
 }
 
 
-void mtp2_dump(struct mtp2 *link, char prefix, unsigned char *buf, int len)
+void mtp2_get_stats(struct mtp2 *link, struct ss7_link_stats *stats)
+{
+	struct ss7_msg *m;
+	struct timeval now;
+	unsigned long long inservice = link->inservice_usec;
+	double period;
+	int i, linkid;
+
+	gettimeofday(&now, NULL);
+
+	*stats = link->stats;
+	stats->slc = link->slc;
+	stats->adjpc = link->dpc;
+	stats->inservice = (link->state == MTP_INSERVICE);
+	if (stats->inservice)
+		inservice += (now.tv_sec - link->inservice_since.tv_sec) * 1000000LL + (now.tv_usec - link->inservice_since.tv_usec);
+	stats->inservice_time = inservice / 1000000;
+
+	period = (now.tv_sec - link->stats_since.tv_sec) + (now.tv_usec - link->stats_since.tv_usec) / 1000000.0;
+	stats->period = period;
+	stats->tx_q_depth = link->tx_q_len;
+	stats->cong_level = link->cong_level;
+	/* The SLS map holds positions in the linkset, not SLCs */
+	for (linkid = 0; linkid < link->master->numlinks && link->master->links[linkid] != link; linkid++)
+		;
+	if (link->master->sls_map_mask & (1 << linkid)) {
+		for (i = 0; i < ((link->master->switchtype == SS7_ITU) ? 16 : SS7_SLS_MAP_SIZE); i++) {
+			if (link->master->sls_map[i] == linkid)
+				stats->sls_codes++;
+		}
+	}
+	stats->tx_buf_depth = len_buf(link->tx_buf);
+	/* tx_buf is newest first */
+	for (m = link->tx_buf; m && m->next; m = m->next)
+		;
+	if (m && timerisset(&m->sent))
+		stats->tx_buf_age = ss7_tvdiff_usec(&now, &m->sent) / 1000;
+
+	if (period > 0) {
+		stats->occupancy_tx = (stats->octets_tx + stats->msu_tx * MTP2_MSU_OVERHEAD) / (period * MTP2_LINK_RATE);
+		stats->occupancy_rx = (stats->octets_rx + stats->msu_rx * MTP2_MSU_OVERHEAD) / (period * MTP2_LINK_RATE);
+	}
+}
+
+void mtp2_reset_stats(struct mtp2 *link)
+{
+	memset(&link->stats, 0, sizeof(link->stats));
+	gettimeofday(&link->stats_since, NULL);
+	link->inservice_since = link->stats_since;
+	link->inservice_usec = 0;
+}
+
+/* Decode a signal unit; only the SLC is taken from the link so it can be done away from the link */
+void mtp2_dump_su(struct ss7 *ss7, int slc, char prefix, unsigned char *buf, int len)
 {
 	struct mtp_su_head *h = (struct mtp_su_head *)buf;
-	unsigned char mtype;
 	char *mtypech = NULL;
 
-	if (!(link->master->debug & SS7_DEBUG_MTP2))
-		return;
+	ss7_dump_msg(ss7, buf, len);
+	ss7_message(ss7, "FSN: %d FIB %d\n", h->fsn, h->fib);
+	ss7_message(ss7, "BSN: %d BIB %d\n", h->bsn, h->bib);
 
 	switch (h->li) {
 		case 0:
-			mtype = 0;
+			ss7_message(ss7, "%c[%d] FISU\n", prefix, slc);
 			break;
 		case 1:
 		case 2:
-			mtype = 1;
-			break;
-		default:
-			mtype = 2;
-			break;
-	}
-
-
-	switch (mtype) {
-		case 0:
-			if (prefix == '<' && link->lastsurxd == FISU)
-				return;
-			if (prefix == '>' && link->lastsutxd == FISU)
-				return;
-			else
-				link->lastsutxd = FISU;
-			ss7_dump_msg(link->master, buf, len);
-			ss7_message(link->master, "FSN: %d FIB %d\n", h->fsn, h->fib);
-			ss7_message(link->master, "BSN: %d BIB %d\n", h->bsn, h->bib);
-
-			ss7_message(link->master, "%c[%d] FISU\n", prefix, link->slc);
-			break; 
-		case 1:
-			if (prefix == '<' && link->lastsurxd == h->data[0])
-				return;
-			if (prefix == '>' && link->lastsutxd == h->data[0])
-				return;
-			else
-				link->lastsutxd = h->data[0];
 			switch (h->data[0]) {
 				case LSSU_SIOS:
 					mtypech = "SIOS";
@@ -878,26 +1086,55 @@ void mtp2_dump(struct mtp2 *link, char prefix, unsigned char *buf, int len)
 					mtypech = "SIB";
 					break;
 			}
-			ss7_dump_msg(link->master, buf, len);
-			ss7_message(link->master, "FSN: %d FIB %d\n", h->fsn, h->fib);
-			ss7_message(link->master, "BSN: %d BIB %d\n", h->bsn, h->bib);
-			ss7_message(link->master, "%c[%d] LSSU %s\n", prefix, link->slc, mtypech);
+			ss7_message(ss7, "%c[%d] LSSU %s\n", prefix, slc, mtypech);
+			break;
+		default:
+			ss7_message(ss7, "%c[%d] MSU\n", prefix, slc);
+			ss7_dump_buf(ss7, 0, buf, 3);
+			mtp3_dump(ss7, NULL, h->data, len - MTP2_SU_HEAD_SIZE);
+			break;
+	}
+
+	ss7_message(ss7, "\n");
+}
+
+void mtp2_dump(struct mtp2 *link, char prefix, unsigned char *buf, int len)
+{
+	struct mtp_su_head *h = (struct mtp_su_head *)buf;
+
+	if (!(link->master->debug & SS7_DEBUG_MTP2))
+		return;
+
+	/* Only the first of a run of identical FISUs or LSSUs is shown */
+	switch (h->li) {
+		case 0:
+			if (prefix == '<' && link->lastsurxd == FISU)
+				return;
+			if (prefix == '>' && link->lastsutxd == FISU)
+				return;
+			else
+				link->lastsutxd = FISU;
 			break;
+		case 1:
 		case 2:
-			ss7_dump_msg(link->master, buf, len);
-			ss7_message(link->master, "FSN: %d FIB %d\n", h->fsn, h->fib);
-			ss7_message(link->master, "BSN: %d BIB %d\n", h->bsn, h->bib);
-			ss7_message(link->master, "%c[%d] MSU\n", prefix, link->slc);
-			ss7_dump_buf(link->master, 0, buf, 3);
-			mtp3_dump(link->master, link, h->data, len - MTP2_SU_HEAD_SIZE);
+			if (prefix == '<' && link->lastsurxd == h->data[0])
+				return;
+			if (prefix == '>' && link->lastsutxd == h->data[0])
+				return;
+			else
+				link->lastsutxd = h->data[0];
 			break;
 	}
 
-	ss7_message(link->master, "\n");
+	if (link->master->trace) {
+		ss7_ring_put(link->master->trace, link->slc, (prefix == '>') ? SS7_FRAME_TX : SS7_FRAME_RX, buf, len);
+		return;
+	}
+
+	mtp2_dump_su(link->master, link->slc, prefix, buf, len);
 }
 
-/* returns an event */
-int mtp2_receive(struct mtp2 *link, unsigned char *buf, int len)
+static int __mtp2_receive(struct mtp2 *link, unsigned char *buf, int len)
 {
 	struct mtp_su_head *h = (struct mtp_su_head *)buf;
 	len -= 2; /* Strip the CRC off */
@@ -907,6 +1144,9 @@ int mtp2_receive(struct mtp2 *link, unsigned char *buf, int len)
 		return 0;
 	}
 	
+	if (h->li > 2)
+		ss7_capture_frame(link->master, link->slc, SS7_FRAME_RX, buf, len);
+
 	mtp2_dump(link, '<', buf, len);
 
 	update_txbuf(link, &link->tx_buf, h->bsn);
@@ -915,16 +1155,19 @@ int mtp2_receive(struct mtp2 *link, unsigned char *buf, int len)
 	if ((link->state == MTP_INSERVICE) &&  (h->bib != link->curfib)) {
 		/* Negative ack */
 		ss7_message(link->master, "Got retransmission request sequence numbers greater than %d. Retransmitting %d message(s).\n", h->bsn, len_buf(link->tx_buf));
+		link->stats.nack_rx++;
 		mtp2_retransmit(link);
 	}
 
 	switch (h->li) {
 		case 0:
 			/* FISU */
+			link->stats.fisu_rx++;
 			return fisu_rx(link, h, len);
 		case 1:
 		case 2:
 			/* LSSU */
+			link->stats.lssu_rx++;
 			return lssu_rx(link, h, len);
 		default:
 			/* MSU */
@@ -933,3 +1176,15 @@ int mtp2_receive(struct mtp2 *link, unsigned char *buf, int len)
 
 	return 0;
 }
+
+/* returns an event */
+int mtp2_receive(struct mtp2 *link, unsigned char *buf, int len)
+{
+	int res;
+
+	SS7_PROF_ENTER(link->master);
+	res = __mtp2_receive(link, buf, len);
+	SS7_PROF_LEAVE(link->master, SS7_PROF_MTP2_RX, -1);
+
+	return res;
+}
@@ -42,6 +42,11 @@
 #define MTP2_SU_HEAD_SIZE 3
 #define MTP2_SIZE MTP2_SU_HEAD_SIZE
 
+/* Header, FCS and flag of every MSU on the wire */
+#define MTP2_MSU_OVERHEAD	6
+/* Octets per second of a 64 kbit/s link, used for the occupancy */
+#define MTP2_LINK_RATE		8000
+
 /* MTP2 Timers */
 /* 	For ITU 64kbps links */
 #define ITU_TIMER_T1		45000
@@ -106,6 +111,12 @@ struct mtp2_timers {
 	int t7;
 };
 
+/* Transmit classes, tx_q is kept in this order */
+#define MTP2_TX_NET_MNG		0
+#define MTP2_TX_TEST		1
+#define MTP2_TX_USER		2
+#define MTP2_TX_CLASSES		3
+
 struct mtp2 {
 	int state;
 	int std_test_passed;
@@ -149,9 +160,17 @@ struct mtp2 {
 
 	/* Line related stats */
 	unsigned int retransmissioncount;
+	struct ss7_link_stats stats;
+	struct timeval stats_since;
+	struct timeval inservice_since;
+	unsigned long long inservice_usec;
 
 	struct ss7_msg *tx_buf;
 	struct ss7_msg *tx_q;
+	/* Last MSU of each class in tx_q, see mtp2_queue_su() */
+	struct ss7_msg *tx_q_tail[MTP2_TX_CLASSES];
+	unsigned int tx_q_len;
+	int cong_level;
 	struct ss7_msg *retransmit_pos;
 	struct ss7_msg *co_tx_buf; /* store here before reset_mtp flush it */
 	struct ss7_msg *co_tx_q;
@@ -174,10 +193,14 @@ struct mtp2 * mtp2_new(int fd, unsigned int switchtype);
 int mtp2_transmit(struct mtp2 *link);
 int mtp2_receive(struct mtp2 *link, unsigned char *buf, int len);
 int mtp2_msu(struct mtp2 *link, struct ss7_msg *m);
+void mtp2_tx_q_update(struct mtp2 *link);
 void mtp2_dump(struct mtp2 *link, char prefix, unsigned char *buf, int len);
+void mtp2_dump_su(struct ss7 *ss7, int slc, char prefix, unsigned char *buf, int len);
 char *linkstate2strext(int linkstate);
 void update_txbuf(struct mtp2 *link, struct ss7_msg **buf, unsigned char upto);
 int len_buf(struct ss7_msg *buf);
 void flush_bufs(struct mtp2 *link);
+void mtp2_get_stats(struct mtp2 *link, struct ss7_link_stats *stats);
+void mtp2_reset_stats(struct mtp2 *link);
 
 #endif /* _SS7_MTP_H */
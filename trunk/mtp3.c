@@ -175,30 +175,63 @@ static inline unsigned char get_h1(unsigned char *byte)
 	return (((*byte) & 0xf0) >> 4);
 }
 
-static inline int link_available(struct ss7 *ss7, int linkid, struct ss7_msg ***buffer, struct routing_label rl)
+static inline unsigned int route_hash(unsigned int dpc)
+{
+	return (dpc ^ (dpc >> 6) ^ (dpc >> 12) ^ (dpc >> 18)) & (MTP3_ROUTE_HASH_SIZE - 1);
+}
+
+static inline struct mtp3_route * mtp3_find_route(struct adjecent_sp *adj_sp, unsigned int dpc)
+{
+	struct mtp3_route *route;
+
+	for (route = adj_sp->route_hash[route_hash(dpc)]; route; route = route->hnext) {
+		if (route->dpc == dpc)
+			return route;
+	}
+
+	return NULL;
+}
+
+static inline struct mtp3_dest * mtp3_find_dest(struct ss7 *ss7, unsigned int dpc)
 {
-	if ((ss7->mtp2_linkstate[linkid] == MTP2_LINKSTATE_UP &&
+	struct mtp3_dest *dest;
+
+	if (!ss7->dest_hash)
+		return NULL;
+
+	for (dest = ss7->dest_hash[route_hash(dpc)]; dest; dest = dest->hnext) {
+		if (dest->dpc == dpc)
+			return dest;
+	}
+
+	return NULL;
+}
+
+/* Link may carry traffic, whatever the route states */
+static inline int link_usable(struct ss7 *ss7, int linkid)
+{
+	return (ss7->mtp2_linkstate[linkid] == MTP2_LINKSTATE_UP &&
 			ss7->links[linkid]->adj_sp->state == MTP3_UP &&
 			ss7->links[linkid]->changeover != CHANGEOVER_COMPLETED) ||
 			(ss7->links[linkid]->changeover == CHANGEOVER_IN_PROGRESS) ||
-			ss7->links[linkid]->changeover == CHANGEBACK_INITIATED) {
-
-		struct mtp3_route *route = ss7->links[linkid]->adj_sp->routes;
-		while (route) {
-			if (route->dpc == rl.dpc) {
-				if (route->t6 > -1) {
-					/* T6 is running, buffering */
-					*buffer = &route->q;
-					return 1;
-				}
-				if (route->state == TFR_NON_ACTIVE || route->state == TFA)
-					break;
-				else {
-					*buffer = NULL;
-					return 0;
-				}
+			ss7->links[linkid]->changeover == CHANGEBACK_INITIATED;
+}
+
+static inline int link_available(struct ss7 *ss7, int linkid, struct ss7_msg ***buffer, struct routing_label rl)
+{
+	if (link_usable(ss7, linkid)) {
+
+		struct mtp3_route *route = mtp3_find_route(ss7->links[linkid]->adj_sp, rl.dpc);
+		if (route) {
+			if (route->t6 > -1) {
+				/* T6 is running, buffering */
+				*buffer = &route->q;
+				return 1;
+			}
+			if (route->state != TFR_NON_ACTIVE && route->state != TFA) {
+				*buffer = NULL;
+				return 0;
 			}
-			route = route->next;
 		}
 			
 		switch (ss7->links[linkid]->changeover) {
@@ -221,27 +254,117 @@ static inline int link_available(struct ss7 *ss7, int linkid, struct ss7_msg ***
 	}
 }
 
-static inline struct mtp2 * rl_to_link(struct ss7 *ss7, struct routing_label rl, struct ss7_msg ***buffer)
+static inline int sls_map_size(struct ss7 *ss7)
 {
-	int linkid;
+	return (ss7->switchtype == SS7_ITU) ? 16 : SS7_SLS_MAP_SIZE;
+}
 
-	linkid = (rl.sls >> ss7->sls_shift) % ss7->numlinks;
+/* SLS values keep their link while it is usable, the ones of unusable
+ * links go one by one to the usable link carrying the fewest so far */
+static void sls_map_build(struct ss7 *ss7, unsigned char *map, unsigned int *map_mask, unsigned int mask)
+{
+	int count[SS7_MAX_LINKS];
+	int i, sls, home, best, size = sls_map_size(ss7);
 
-	if (link_available(ss7, linkid, buffer, rl))
-		return ss7->links[linkid];
-	else {
-		struct mtp2 *winner = NULL;
-		int i;
+	memset(count, 0, sizeof(count));
+
+	for (sls = 0; sls < size; sls++) {
+		home = (sls >> ss7->sls_shift) % ss7->numlinks;
+		if (mask & (1 << home)) {
+			map[sls] = home;
+			count[home]++;
+		}
+	}
 
+	for (sls = 0; sls < size; sls++) {
+		home = (sls >> ss7->sls_shift) % ss7->numlinks;
+		if (mask & (1 << home))
+			continue;
+		best = -1;
 		for (i = 0; i < ss7->numlinks; i++) {
-			if (link_available(ss7, i, buffer, rl)) {
-				winner = ss7->links[i];
-				break;
-			}
+			if ((mask & (1 << i)) && (best < 0 || count[i] < count[best]))
+				best = i;
 		}
+		map[sls] = best;
+		count[best]++;
+	}
 
-		return winner;
+	*map_mask = mask;
+}
+
+/* Usable links of the adjacent SPs with the best priority towards 'dest' */
+static unsigned int dest_links(struct ss7 *ss7, struct mtp3_dest *dest, unsigned int mask)
+{
+	struct adjecent_sp *adj_sp;
+	struct mtp3_route *route;
+	unsigned int res = 0;
+	int i, j, best = -1;
+
+	for (i = 0; i < ss7->numlinks; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		adj_sp = ss7->links[i]->adj_sp;
+		for (j = 0; j < dest->numroutes && dest->adjpc[j] != adj_sp->adjpc; j++)
+			;
+		if (j == dest->numroutes)
+			continue;
+		route = mtp3_find_route(adj_sp, dest->dpc);
+		if (route && route->t6 == -1 && route->state != TFR_NON_ACTIVE && route->state != TFA)
+			continue;
+		if (best == -1 || dest->priority[j] < best) {
+			best = dest->priority[j];
+			res = 0;
+		}
+		if (dest->priority[j] == best)
+			res |= 1 << i;
 	}
+
+	return res;
+}
+
+static inline struct mtp2 * rl_to_link(struct ss7 *ss7, struct routing_label rl, struct ss7_msg ***buffer)
+{
+	struct mtp3_dest *dest;
+	unsigned char *map = ss7->sls_map;
+	unsigned int *map_mask = &ss7->sls_map_mask;
+	unsigned int mask = 0;
+	int i, linkid;
+
+	/* A few fields per link, so the map never routes on stale link states */
+	for (i = 0; i < ss7->numlinks; i++) {
+		if (link_usable(ss7, i))
+			mask |= 1 << i;
+	}
+
+	if (mask && (dest = mtp3_find_dest(ss7, rl.dpc)) && dest->numroutes) {
+		mask = dest_links(ss7, dest, mask);
+		map = dest->sls_map;
+		map_mask = &dest->sls_map_mask;
+	}
+
+	if (!mask) {
+		*buffer = NULL;
+		return NULL;
+	}
+
+	if (mask != *map_mask)
+		sls_map_build(ss7, map, map_mask, mask);
+
+	linkid = map[rl.sls & (sls_map_size(ss7) - 1)];
+
+	if (!link_available(ss7, linkid, buffer, rl)) {
+		/* The route is not available over the mapped link */
+		for (linkid = 0; linkid < ss7->numlinks; linkid++) {
+			if ((mask & (1 << linkid)) && link_available(ss7, linkid, buffer, rl))
+				break;
+		}
+		if (linkid == ss7->numlinks)
+			return NULL;
+	}
+
+	ss7->links[linkid]->stats.ls_msus++;
+
+	return ss7->links[linkid];
 }
 
 struct net_mng_message net_mng_messages[] = {
@@ -408,16 +531,9 @@ static int available_links(struct ss7 *ss7, int dpc, int ignore_inhibit)
 			if (dpc == -1)
 				res++;
 			else {
-				route = ss7->links[i]->adj_sp->routes;
-				while (route) {
-					if (route->dpc == dpc ) {
-						if (route->state == TFA || route->state == TFR_NON_ACTIVE)
-							res++;
-						break;
-					}
-					route = route->next;
-				}
-			
+				route = mtp3_find_route(ss7->links[i]->adj_sp, dpc);
+				if (route && (route->state == TFA || route->state == TFR_NON_ACTIVE))
+					res++;
 			}
 		}
 	return res;
@@ -544,78 +660,104 @@ static void mtp3_event_link_up(struct mtp2 * link)
 	}
 }
 
+static int mtp3_to_buffer(struct ss7 *ss7, struct ss7_msg **buf, struct ss7_msg *m);
+static int mtp3_dest_throttle(struct ss7 *ss7, unsigned int dpc, struct ss7_msg *m);
+
+/* Changeover and rerouting move user traffic only */
+static inline int mtp3_msg_moves(struct ss7_msg *m, int dpc)
+{
+	return m->userpart > 3 && (dpc == -1 || m->dpc == dpc);
+}
+
+/* Splices the MSUs for dpc (or all with -1) from a link buffer behind *tail,
+ * a whole run at a time, using the label cached by mtp3_transmit() */
+static void mtp3_splice_buffer(struct mtp2 *link, struct ss7_msg **from, struct ss7_msg ***tail, int dpc)
+{
+	struct ss7_msg **pp = from, *newer = NULL, *first, *last, *cur;
+	int retransmit;
+
+	while (*pp) {
+		if (!mtp3_msg_moves(*pp, dpc)) {
+			newer = *pp;
+			pp = &newer->next;
+			continue;
+		}
+
+		first = last = *pp;
+		retransmit = (last == link->retransmit_pos);
+		while (last->next && mtp3_msg_moves(last->next, dpc)) {
+			last = last->next;
+			if (last == link->retransmit_pos)
+				retransmit = 1;
+		}
+
+		*pp = last->next;
+		last->next = NULL;
+
+		/* tx_buf is newest first, retransmission goes on with the next newer MSU */
+		if (retransmit)
+			link->retransmit_pos = newer;
+
+		if (tail) {
+			**tail = first;
+			*tail = &last->next;
+		} else {
+			while ((cur = first)) {
+				first = cur->next;
+				ss7_msg_free(cur);
+			}
+		}
+	}
+
+	if (from == &link->tx_q)
+		mtp2_tx_q_update(link);
+}
+
 static void mtp3_move_buffer(struct ss7 *ss7, struct mtp2 *link, struct ss7_msg **from, struct ss7_msg **to, int dpc, int fsn)
 {
-	struct ss7_msg *cur, *prev, *next, *dst;
-	unsigned char *buf;
-	unsigned char userpart;
-	struct routing_label rl;
-	int rlsize;
-	
+	struct ss7_msg **tail = to;
+
 	if (fsn != -1)
 		update_txbuf(NULL, from, fsn);
-	
-	prev = NULL;
-	cur = *from;
-	
-	if (to && *to)
-		for (dst = *to; dst->next; dst = dst->next);
-	else
-		dst = NULL;
-		
-	while (cur) {
-		buf = cur->buf;
-		userpart = get_userpart(buf[MTP2_SIZE]);
-		rlsize = get_routinglabel(ss7->switchtype, buf + MTP2_SIZE + 1, &rl);
-		next = cur->next;
-		
-		if (userpart > 3 && (dpc == -1 || rl.dpc == dpc)) {
-			
-			if (cur == link->retransmit_pos)
-				link->retransmit_pos = cur->next;
-			
-			if (*from == link->tx_buf || *from == link->tx_q ||
-					*from == link->co_tx_buf || *from == link->co_tx_q)
-				cur->size -= 2; /* mtp2_msu increased it before!!! */
-			
-			if (prev)
-				prev->next = cur->next;
-			else
-				*from = cur->next;
-			
-							
-			if (to) {
-				if (dst) {
-					dst->next = cur;
-					dst = dst->next;
-				} else {
-					*to = cur;
-					dst = cur;
-				}
-				dst->next = NULL;
-			} else
-				free (cur);
-		} else
-			prev = cur;
 
-		cur = next;
-	}
+	if (to)
+		while (*tail)
+			tail = &(*tail)->next;
+
+	mtp3_splice_buffer(link, from, to ? &tail : NULL, dpc);
 }
 
+/* Retrieved MSUs already carry their SIO, they only need a new link */
 static void mtp3_transmit_buffer(struct ss7 *ss7, struct ss7_msg **buf)
 {
-	unsigned char userpart;
 	struct routing_label rl;
-	struct ss7_msg *cur = *buf, *next;
-	
+	struct ss7_msg *cur = *buf, *next, **buffer;
+	struct mtp2 *winner;
+
+	/* Rerouting may put them back in the same buffer */
+	*buf = NULL;
+
+	rl.type = ss7->switchtype;
+	rl.opc = ss7->pc;
+
 	while (cur) {
 		next = cur->next;
-		userpart = get_userpart(cur->buf[MTP2_SIZE]);
-		get_routinglabel(ss7->switchtype, cur->buf + MTP2_SIZE + 1, &rl);
-		mtp3_transmit(ss7, userpart, rl, cur, NULL);
+		cur->next = NULL;
+		rl.dpc = cur->dpc;
+		rl.sls = cur->sls;
+
+		if (cur->userpart > SIG_SPEC_TEST && mtp3_dest_throttle(ss7, rl.dpc, cur)) {
+			ss7_msg_free(cur);
+		} else if (!(winner = rl_to_link(ss7, rl, &buffer))) {
+			ss7_error(ss7, "No siganlling link available sending message!\n");
+			ss7_msg_free(cur);
+		} else if (buffer)
+			mtp3_to_buffer(ss7, buffer, cur);
+		else
+			mtp2_msu(winner, cur);
+
 		cur = next;
 	}
-	*buf = NULL;
 }
 
 void mtp3_free_co(struct mtp2 *link)
@@ -781,6 +923,7 @@ static void mtp3_changeback(struct mtp2 *link)
 	else if (link->changeover != CHANGEBACK && link->changeover != NO_CHANGEOVER){
 		mtp3_move_buffer(link->master, link, &link->tx_q, &link->cb_buf, -1, -1);
 		link->changeover = CHANGEBACK;
+		link->stats.changebacks++;
 		link->mtp3_timer[MTP3_TIMER_T3] = ss7_schedule_event(link->master, link->master->mtp3_timers[MTP3_TIMER_T3], &mtp3_t3_expired, link);
 		ss7_message(link->master, "Changeback started on link SLC %i PC %i\n", link->slc, link->dpc);
 	}
@@ -817,6 +960,7 @@ static void mtp3_timed_changeover(struct mtp2 *link)
 		mtp3_cancel_changeback(link);
 	if (link->changeover == NO_CHANGEOVER) {
 		link->changeover = CHANGEOVER_IN_PROGRESS;
+		link->stats.changeovers++;
 		mtp3_move_buffer(link->master, link, &link->tx_q, &link->co_buf, -1, -1);
 		ss7_message(link->master, "Time controlled changeover initiated on link SLC: %i PC: %i\n", link->slc, link->dpc);
 		link->changeover = CHANGEOVER_IN_PROGRESS;
@@ -829,14 +973,23 @@ static void mtp3_timed_changeover(struct mtp2 *link)
 
 static void mtp3_changeover(struct mtp2 *link, unsigned char fsn)
 {
-	struct ss7_msg *tmp = NULL;
+	struct ss7_msg *tmp = NULL, **tail = &tmp, *cur, *next;
 	if (link->changeover == CHANGEBACK || link->changeover == CHANGEBACK_INITIATED)
 		mtp3_cancel_changeback(link);
 	if (link->changeover == NO_CHANGEOVER || 
 			link->changeover == CHANGEOVER_INITIATED) {
-		mtp3_move_buffer(link->master, link, &link->co_tx_buf, &tmp, -1, fsn);
-		mtp3_move_buffer(link->master, link, &link->co_tx_q, &tmp, -1, -1);
-		mtp3_move_buffer(link->master, link, &link->co_buf, &tmp, -1, -1);
+		if (link->changeover == NO_CHANGEOVER)
+			link->stats.changeovers++;
+		update_txbuf(NULL, &link->co_tx_buf, fsn);
+		/* Retransmission buffer goes out oldest first, ahead of the queue */
+		for (cur = link->co_tx_buf, link->co_tx_buf = NULL; cur; cur = next) {
+			next = cur->next;
+			cur->next = link->co_tx_buf;
+			link->co_tx_buf = cur;
+		}
+		mtp3_splice_buffer(link, &link->co_tx_buf, &tail, -1);
+		mtp3_splice_buffer(link, &link->co_tx_q, &tail, -1);
+		mtp3_splice_buffer(link, &link->co_buf, &tail, -1);
 		mtp3_transmit_buffer(link->master, &tmp);
 		link->changeover = CHANGEOVER_COMPLETED;
 		ss7_message (link->master, "Changeover completed on link SLC: %i PC: %i FSN: %i\n", link->slc, link->dpc, fsn);
@@ -851,11 +1004,13 @@ static void mtp3_prepare_changeover(struct mtp2 *link)
 		mtp3_cancel_changeback(link);
 	if (link->changeover != CHANGEOVER_INITIATED) {
 		link->changeover = CHANGEOVER_INITIATED;
+		link->stats.changeovers++;
 		link->co_lastfsnacked = link->lastfsnacked;
 		link->co_tx_buf = link->tx_buf;
 		link->tx_buf = NULL;
 		link->co_tx_q = link->tx_q;
 		link->tx_q = NULL;
+		mtp2_tx_q_update(link);
 		link->retransmit_pos = NULL;
 	}
 #if 0
@@ -960,8 +1115,15 @@ static void mtp3_forced_reroute(struct adjecent_sp *adj_sp, struct mtp3_route *r
 
 static void mtp3_destroy_route(struct adjecent_sp *adj_sp, struct mtp3_route *route)
 {
-	struct mtp3_route *prev;
+	struct mtp3_route *prev, **h;
 	
+	for (h = &adj_sp->route_hash[route_hash(route->dpc)]; *h; h = &(*h)->hnext) {
+		if (*h == route) {
+			*h = route->hnext;
+			break;
+		}
+	}
+
 	if (route == adj_sp->routes)
 		adj_sp->routes = route->next;
 	else {
@@ -1001,9 +1163,12 @@ static void mtp3_controlled_reroute(struct adjecent_sp *adj_sp, struct mtp3_rout
 	int i = 0;
 	struct ss7 *ss7 = adj_sp->master;
 	struct mtp2 *link;
+	int combined = (mtp3_find_dest(ss7, route->dpc) != NULL);
 	
-	for (i = 0; i < adj_sp->numlinks; i++) {
-		link = adj_sp->links[i];
+	/* In a combined linkset the traffic may come back from the other
+	 * adjacent SPs, hold it all for T6 to keep the sequence */
+	for (i = 0; i < (combined ? ss7->numlinks : adj_sp->numlinks); i++) {
+		link = combined ? ss7->links[i] : adj_sp->links[i];
 		mtp3_move_buffer(ss7, link, &link->tx_q, &route->q, route->dpc, -1);
 		mtp3_move_buffer(ss7, link, &link->co_buf, &route->q, route->dpc, -1);
 		mtp3_move_buffer(ss7, link, &link->cb_buf, &route->q, route->dpc, -1);
@@ -1020,36 +1185,30 @@ static void mtp3_controlled_reroute(struct adjecent_sp *adj_sp, struct mtp3_rout
 	route->t6 = ss7_schedule_event(ss7, ss7->mtp3_timers[MTP3_TIMER_T6], &mtp3_t6_expired, route);
 }
 
-static void mtp3_add_set_route(struct adjecent_sp *adj_sp, unsigned short dpc, int state)
+static void mtp3_add_set_route(struct adjecent_sp *adj_sp, unsigned int dpc, int state)
 {
-	struct mtp3_route *cur = adj_sp->routes;
-	struct mtp3_route *prev = adj_sp->routes;
-	
-	int set = 0;
+	struct mtp3_route *cur, *prev;
+	unsigned int h;
 	
-	while (cur) {
-		if (cur->dpc == dpc) {
-			set = 1;
-			cur->state = state;
-			break;
-		}
-		prev = cur;
-		cur = cur->next;
-	}
-	
-	if (!set && state == TFA)
+	cur = mtp3_find_route(adj_sp, dpc);
+	if (cur)
+		cur->state = state;
+	else if (state == TFA)
 		return;
-	
-	if (!set) {
+	else {
 		cur = calloc(1, sizeof(struct mtp3_route));
 		if (!cur) {
 			ss7_error(adj_sp->master, "calloc failed!!!\n");
 			return;
 		}
+		for (prev = adj_sp->routes; prev && prev->next; prev = prev->next);
 		if (prev)
 			prev->next = cur;
 		else
 			adj_sp->routes = cur;
+		h = route_hash(dpc);
+		cur->hnext = adj_sp->route_hash[h];
+		adj_sp->route_hash[h] = cur;
 		
 		cur->owner = adj_sp;
 		cur->dpc = dpc;
@@ -1080,6 +1239,116 @@ static struct mtp2 * netmng_adjpc_sls_to_mtp2(struct ss7 *ss7, unsigned int adjp
 	return link;
 }
 
+/* Q.704 13.9 defaults, used until the timers are configured */
+#define MTP3_DEFAULT_T15	3000
+#define MTP3_DEFAULT_T16	2000
+
+static struct mtp3_dest * mtp3_new_dest(struct ss7 *ss7, unsigned int dpc);
+
+static int mtp3_cong_timer(struct ss7 *ss7, int timer)
+{
+	if (ss7->mtp3_timers[timer] > 0)
+		return ss7->mtp3_timers[timer];
+
+	return (timer == MTP3_TIMER_T15) ? MTP3_DEFAULT_T15 : MTP3_DEFAULT_T16;
+}
+
+static void mtp3_dest_cong_event(struct ss7 *ss7, struct mtp3_dest *dest)
+{
+	ss7_event *e = ss7_next_empty_event(ss7);
+
+	if (!e) {
+		mtp_error(ss7, "Could not queue event\n");
+		return;
+	}
+	e->dpccong.e = SS7_EVENT_DPC_CONGESTION;
+	e->dpccong.dpc = dest->dpc;
+	e->dpccong.level = dest->cong_status;
+}
+
+static void mtp3_t16_expired(void *data);
+
+/* Test the route set with RCT at the priority just below the congestion
+ * status, a congested STP on the way answers with TFC */
+static void mtp3_send_rct(struct ss7 *ss7, struct mtp3_dest *dest)
+{
+	struct routing_label rl;
+
+	rl.dpc = dest->dpc;
+	rl.opc = ss7->pc;
+	rl.sls = dest->cong_link->net_mng_sls;
+
+	net_mng_send(dest->cong_link, NET_MNG_RCT, rl, 0);
+	dest->t16 = ss7_schedule_event(ss7, mtp3_cong_timer(ss7, MTP3_TIMER_T16), &mtp3_t16_expired, dest);
+}
+
+static void mtp3_t15_expired(void *data)
+{
+	struct mtp3_dest *dest = data;
+	struct ss7 *ss7 = dest->cong_link->master;
+
+	dest->t15 = -1;
+	mtp3_send_rct(ss7, dest);
+}
+
+/* No TFC came back, the congestion abates one level at a time */
+static void mtp3_t16_expired(void *data)
+{
+	struct mtp3_dest *dest = data;
+	struct ss7 *ss7 = dest->cong_link->master;
+
+	dest->t16 = -1;
+	if (dest->cong_status > 0)
+		dest->cong_status--;
+
+	ss7_message(ss7, "Congestion status of DPC %d reduced to %d\n", dest->dpc, dest->cong_status);
+	mtp3_dest_cong_event(ss7, dest);
+
+	if (dest->cong_status)
+		mtp3_send_rct(ss7, dest);
+}
+
+static void mtp3_tfc_receive(struct ss7 *ss7, struct mtp2 *link, unsigned int dpc, int status)
+{
+	struct mtp3_dest *dest;
+
+	if (!status)
+		status = 1;
+
+	dest = mtp3_new_dest(ss7, dpc);
+	if (!dest)
+		return;
+
+	dest->learned = 1;
+	dest->cong_link = link;
+
+	if (status > dest->cong_status) {
+		ss7_message(ss7, "TFC received, congestion status of DPC %d is %d\n", dpc, status);
+		dest->cong_status = status;
+		mtp3_dest_cong_event(ss7, dest);
+	}
+
+	/* A TFC during T16 starts over the wait for the congestion to abate */
+	if (dest->t16 > -1)
+		ss7_schedule_del(ss7, &dest->t16);
+	if (dest->t15 == -1)
+		dest->t15 = ss7_schedule_event(ss7, mtp3_cong_timer(ss7, MTP3_TIMER_T15), &mtp3_t15_expired, dest);
+}
+
+/* Route set congestion status of 'dpc' from TFC, 0 when not congested */
+int mtp3_dest_congestion(struct ss7 *ss7, unsigned int dpc)
+{
+	struct mtp3_dest *dest;
+
+	/* ISUP shards ask their linkset */
+	if (ss7->parent)
+		ss7 = ss7->parent;
+
+	dest = mtp3_find_dest(ss7, dpc);
+
+	return dest ? dest->cong_status : 0;
+}
+
 static int net_mng_receive(struct ss7 *ss7, struct mtp2 *mtp2, struct routing_label *rl, unsigned char *buf, int len)
 {
 	unsigned char *headerptr = buf + rl_size(ss7);
@@ -1087,7 +1356,8 @@ static int net_mng_receive(struct ss7 *ss7, struct mtp2 *mtp2, struct routing_la
 	struct routing_label rlr;
 	struct mtp2 *winner = netmng_adjpc_sls_to_mtp2(mtp2->master, rl->opc, rl->sls); /* changeover, changeback!!! */
 
-	if (!winner && *headerptr != (NET_MNG_TRA) && *headerptr != (NET_MNG_TFA) && *headerptr != (NET_MNG_TFP) && *headerptr != (NET_MNG_TFR)) {
+	if (!winner && *headerptr != (NET_MNG_TRA) && *headerptr != (NET_MNG_TFA) && *headerptr != (NET_MNG_TFP) && *headerptr != (NET_MNG_TFR) &&
+			*headerptr != (NET_MNG_TFC) && *headerptr != (NET_MNG_RCT)) {
 		ss7_error(ss7, "winner == NULL !!!\n");
 		return -1;
 	}
@@ -1287,6 +1557,16 @@ static int net_mng_receive(struct ss7 *ss7, struct mtp2 *mtp2, struct routing_la
 		case NET_MNG_TFA:
 			mtp3_add_set_route(mtp2->adj_sp, pc2int(ss7->switchtype, paramptr), TFA);
 			return 0;
+		case NET_MNG_TFC:
+			/* International TFCs carry no status */
+			if (ss7->switchtype == SS7_ITU)
+				mtp3_tfc_receive(ss7, mtp2, pc2int(ss7->switchtype, paramptr), (paramptr[1] >> 6) & 0x3);
+			else
+				mtp3_tfc_receive(ss7, mtp2, pc2int(ss7->switchtype, paramptr), paramptr[3] & 0x3);
+			return 0;
+		case NET_MNG_RCT:
+			/* Only there to make a congested STP on the way send TFC */
+			return 0;
 		default:
 			ss7_error(ss7, "Unkonwn NET MNG %u on link SLC: %i from ADJPC: %i\n", *headerptr, winner->slc, winner->dpc);
 
@@ -1300,12 +1580,12 @@ static int net_mng_receive(struct ss7 *ss7, struct mtp2 *mtp2, struct routing_la
 static void mtp3_t2_expired(void * data)
 {
 	struct mtp2 *link = data;
-	struct ss7_msg *tmp = NULL;
+	struct ss7_msg *tmp = NULL, **tail = &tmp;
 
 	link->mtp3_timer[MTP3_TIMER_T2] = -1;
 	link->got_sent_netmsg &= ~(SENT_COO | SENT_ECO);
-	mtp3_move_buffer(link->master, link, &link->co_tx_q, &tmp, -1, -1);
-	mtp3_move_buffer(link->master, link, &link->co_buf, &tmp, -1, -1);
+	mtp3_splice_buffer(link, &link->co_tx_q, &tail, -1);
+	mtp3_splice_buffer(link, &link->co_buf, &tail, -1);
 	mtp3_transmit_buffer(link->master, &tmp);
 	link->changeover = CHANGEOVER_COMPLETED;
 	mtp3_free_co(link);
@@ -1486,6 +1766,7 @@ int net_mng_send(struct mtp2 *link, unsigned char h0h1, struct routing_label rl,
 			ss7_msg_userpart_len(m, rllen + 1); /* no more params */
 			break;
 		case NET_MNG_ECA:
+		case NET_MNG_RCT:
 			ss7_msg_userpart_len(m, rllen + 1); /* no more params */
 			break;
 		case NET_MNG_LFU:
@@ -1684,8 +1965,10 @@ fail:
 	return -1;
 }
 
-static int mtp3_to_buffer(struct ss7_msg **buf, struct ss7_msg *m)
+static int mtp3_to_buffer(struct ss7 *ss7, struct ss7_msg **buf, struct ss7_msg *m)
 {
+	unsigned int len = 1;
+
 	m->next = NULL;
 
 	if (!(*buf)) {
@@ -1694,13 +1977,56 @@ static int mtp3_to_buffer(struct ss7_msg **buf, struct ss7_msg *m)
 	}
 
 	struct ss7_msg *cur = *buf;
-	for (cur = *buf; cur->next; cur = cur->next);
+	for (cur = *buf; cur->next; cur = cur->next)
+		len++;
+
+	/* Changeover and route buffers stop at the highest discard threshold */
+	if (ss7->cong_discard[3] && len >= ss7->cong_discard[3]) {
+		mtp_error(ss7, "Buffer of %u MSUs full, discarding MSU\n", len);
+		ss7_msg_free(m);
+		return -1;
+	}
 	
 	cur->next = m;
 	
 	return 0;
 }
 
+/* ISUP message type of an MSU, -1 for other user parts */
+static inline int msu_isup_type(struct ss7 *ss7, struct ss7_msg *m)
+{
+	if (get_userpart(m->buf[MTP2_SIZE]) != SIG_ISUP || m->size < MTP2_SIZE + SIO_SIZE + rl_size(ss7) + CIC_SIZE + 1)
+		return -1;
+
+	return m->buf[MTP2_SIZE + SIO_SIZE + rl_size(ss7) + CIC_SIZE];
+}
+
+/* Congestion priority, 0 to 3.  ANSI carries it in the SIO; ITU has none,
+ * so network management goes first and new calls last as in ANSI. */
+int mtp3_msu_priority(struct ss7 *ss7, struct ss7_msg *m)
+{
+	unsigned char userpart = get_userpart(m->buf[MTP2_SIZE]);
+
+	if (ss7->switchtype == SS7_ANSI)
+		return (m->buf[MTP2_SIZE] >> 4) & 0x3;
+
+	if (userpart != SIG_ISUP)
+		return (userpart <= SIG_SPEC_TEST) ? 3 : 1;
+
+	return (msu_isup_type(ss7, m) == ISUP_IAM) ? 0 : 1;
+}
+
+static int mtp3_dest_throttle(struct ss7 *ss7, unsigned int dpc, struct ss7_msg *m)
+{
+	struct mtp3_dest *dest = mtp3_find_dest(ss7, dpc);
+
+	if (!dest || !dest->cong_status || mtp3_msu_priority(ss7, m) >= dest->cong_status)
+		return 0;
+
+	dest->cong_discards++;
+	return 1;
+}
+
 int mtp3_transmit(struct ss7 *ss7, unsigned char userpart, struct routing_label rl, struct ss7_msg *m, struct mtp2 *link)
 {
 	unsigned char *sio;
@@ -1709,23 +2035,45 @@ int mtp3_transmit(struct ss7 *ss7, unsigned char userpart, struct routing_label
 	struct ss7_msg **buffer = NULL;
 	int priority = 3;
 
+	/* ISUP shards send through the I/O thread of their linkset */
+	if (ss7->parent)
+		return ss7_shard_transmit(ss7, userpart, rl, m);
+
 	sio = m->buf + MTP2_SIZE;
 	sif = sio + 1;
 
-	if (userpart == SIG_ISUP)
+	m->dpc = rl.dpc;
+	m->sls = rl.sls;
+	m->userpart = userpart;
+
+	/* Without a link, as for relayed MSUs coming back from a route buffer */
+	if (userpart == SIG_ISUP || !link) {
+		SS7_PROF_ENTER(ss7);
 		winner = rl_to_link(ss7, rl, &buffer);
-	else
+		SS7_PROF_LEAVE(ss7, SS7_PROF_ROUTING, -1);
+	} else
 		winner = link;
 
 	if (ss7->switchtype == SS7_ITU)
 		(*sio) = (ss7->ni << 6) | userpart;
-	else
+	else {
+		/* New calls are the first to go under congestion */
+		if (userpart == SIG_ISUP)
+			priority = (msu_isup_type(ss7, m) == ISUP_IAM) ? 0 : 1;
+		else if (userpart == SIG_NET_MNG && sif[rl_size(ss7)] == (NET_MNG_RCT) && mtp3_dest_congestion(ss7, rl.dpc))
+			priority = mtp3_dest_congestion(ss7, rl.dpc) - 1;
 		(*sio) = (ss7->ni << 6) | (priority << 4) | userpart;
+	}
 
+	/* Traffic below the congestion status of the destination is dropped */
+	if (userpart > SIG_SPEC_TEST && mtp3_dest_throttle(ss7, rl.dpc, m)) {
+		ss7_msg_free(m);
+		return -1;
+	}
 
 	if (winner) {
 		if (buffer)
-			return mtp3_to_buffer(buffer, m);
+			return mtp3_to_buffer(ss7, buffer, m);
 		else
 			return mtp2_msu(winner, m);
 	} else {
@@ -1773,7 +2121,61 @@ int mtp3_dump(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
 	return 0;
 }
 
-int mtp3_receive(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
+/* Runs on the outgoing linkset */
+int mtp3_relay(struct ss7 *ss7, struct routing_label rl, struct ss7_msg *m)
+{
+	struct ss7_msg **buffer = NULL;
+	struct mtp2 *winner;
+	unsigned char *sio = m->buf + MTP2_SIZE;
+
+	/* Only the network indicator may differ between the linksets */
+	*sio = (ss7->ni << 6) | (*sio & 0x3f);
+	m->dpc = rl.dpc;
+	m->sls = rl.sls;
+	m->userpart = get_userpart(*sio);
+
+	winner = rl_to_link(ss7, rl, &buffer);
+	if (!winner) {
+		mtp_error(ss7, "No route to relay MSU for point code %d, dropping\n", rl.dpc);
+		ss7_msg_free(m);
+		return -1;
+	}
+
+	if (buffer)
+		return mtp3_to_buffer(ss7, buffer, m);
+
+	return mtp2_msu(winner, m);
+}
+
+static int mtp3_relay_receive(struct ss7 *ss7, struct mtp2 *link, unsigned char *buf, int len, struct routing_label *rl)
+{
+	struct mtp3_dest *dest = mtp3_find_dest(ss7, rl->dpc);
+	struct ss7_msg *m = ss7->rx_msg;
+
+	if (!dest || !dest->relay) {
+		mtp_error(ss7, "Received message destined for point code 0x%x but we're 0x%x.  Dropping\n", rl->dpc, ss7->pc);
+		return -1;
+	}
+
+	if (m && buf == m->buf + MTP2_SIZE) {
+		/* ss7_read() put the frame in a message buffer, it goes out as it is */
+		ss7->rx_msg = NULL;
+	} else {
+		m = ss7_msg_new();
+		if (!m) {
+			ss7_error(ss7, "Unable to allocate message buffer!\n");
+			return -1;
+		}
+		memcpy(m->buf + MTP2_SIZE, buf, len);
+	}
+	m->size = MTP2_SIZE + len;
+
+	link->stats.relayed++;
+
+	return ss7_relay_transmit(dest->relay, *rl, m);
+}
+
+static int __mtp3_receive(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
 {
 	unsigned char *buf = (unsigned char *)msg;
 	unsigned char *sio = &buf[0];
@@ -1782,7 +2184,7 @@ int mtp3_receive(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
 	unsigned char ni = get_ni(*sio);
 	unsigned char userpart = get_userpart(*sio);
 	struct routing_label rl;
-	int rlsize;
+	int rlsize, res;
 
 	/* Check NI to make sure it's set correct */
 	if (ss7->ni != ni) {
@@ -1793,11 +2195,14 @@ int mtp3_receive(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
 	/* Check point codes to make sure the message is destined for us */
 	rlsize = get_routinglabel(ss7->switchtype, sif, &rl);
 
-	if (ss7->pc != rl.dpc) {
-		mtp_error(ss7, "Received message destined for point code 0x%x but we're 0x%x.  Dropping\n", rl.dpc, ss7->pc);
-		return -1;
+	if (ss7->screen && ss7_screen_msu(ss7, userpart, &rl, sif + rlsize, siflen - rlsize) == SS7_SCREEN_DENY) {
+		link->stats.screened++;
+		return 0;
 	}
 
+	if (ss7->pc != rl.dpc)
+		return mtp3_relay_receive(ss7, link, buf, len, &rl);
+
 	/* TODO: find out what to do with the priority in ANSI networks */
 
 	/* Pass it to the correct user part */
@@ -1807,14 +2212,19 @@ int mtp3_receive(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
 			return std_test_receive(ss7, link, sif, siflen);
 		case SIG_ISUP:
 			/* Skip the routing label */
-			if (link->adj_sp->state == MTP3_UP)
+			if (link->adj_sp->state == MTP3_UP) {
+				if (ss7->shards)
+					return ss7_shard_receive(ss7, &rl, sif + rlsize, siflen - rlsize);
 				return isup_receive(ss7, link, &rl, sif + rlsize, siflen - rlsize);
-			else {
+			} else {
 				ss7_error(ss7, "Got ISUP message on link while MTP3 state is not UP!\n");
 				return 0;
 			}
 		case SIG_NET_MNG:
-			return net_mng_receive(ss7, link, &rl, sif, siflen);
+			SS7_PROF_ENTER(ss7);
+			res = net_mng_receive(ss7, link, &rl, sif, siflen);
+			SS7_PROF_LEAVE(ss7, SS7_PROF_NET_MNG, -1);
+			return res;
 		case SIG_SCCP:
 		default:
 			mtp_message(ss7, "Unable to process message destined for userpart %d; dropping message\n", userpart);
@@ -1822,6 +2232,17 @@ int mtp3_receive(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
 	}
 }
 
+int mtp3_receive(struct ss7 *ss7, struct mtp2 *link, void *msg, int len)
+{
+	int res;
+
+	SS7_PROF_ENTER(ss7);
+	res = __mtp3_receive(ss7, link, msg, len);
+	SS7_PROF_LEAVE(ss7, SS7_PROF_MTP3_RX, -1);
+
+	return res;
+}
+
 static void mtp3_event_link_down(struct mtp2 *link)
 {
 	struct ss7 *ss7 = link->master;
@@ -1990,6 +2411,10 @@ int ss7_set_mtp3_timer(struct ss7 *ss7, char *name, int ms)
 		ss7->mtp3_timers[MTP3_TIMER_T10] = ms;
 	else if (!strcasecmp(name, "t13"))
 		ss7->mtp3_timers[MTP3_TIMER_T13] = ms;
+	else if (!strcasecmp(name, "t15"))
+		ss7->mtp3_timers[MTP3_TIMER_T15] = ms;
+	else if (!strcasecmp(name, "t16"))
+		ss7->mtp3_timers[MTP3_TIMER_T16] = ms;
 	else if (!strcasecmp(name, "t14"))
 		ss7->mtp3_timers[MTP3_TIMER_T14] = ms;
 	else if (!strcasecmp(name, "t19"))
@@ -2035,6 +2460,10 @@ char * mtp3_timer2str(int mtp3_timer)
 			return "T13";
 		case MTP3_TIMER_T14:
 			return "T14";
+		case MTP3_TIMER_T15:
+			return "T15";
+		case MTP3_TIMER_T16:
+			return "T16";
 		case MTP3_TIMER_T19:
 			return "T19";
 		case MTP3_TIMER_T21:
@@ -2112,6 +2541,145 @@ void mtp3_add_adj_sp(struct mtp2 *link)
 		mtp3_new_adjsp(ss7, link);
 }
 
+static struct mtp3_dest * mtp3_new_dest(struct ss7 *ss7, unsigned int dpc)
+{
+	struct mtp3_dest *dest;
+
+	if (!ss7->dest_hash) {
+		ss7->dest_hash = calloc(MTP3_ROUTE_HASH_SIZE, sizeof(struct mtp3_dest *));
+		if (!ss7->dest_hash) {
+			ss7_error(ss7, "Unable to allocate destination table\n");
+			return NULL;
+		}
+	}
+
+	dest = mtp3_find_dest(ss7, dpc);
+	if (dest)
+		return dest;
+
+	dest = calloc(1, sizeof(*dest));
+	if (!dest) {
+		ss7_error(ss7, "Unable to allocate destination %d\n", dpc);
+		return NULL;
+	}
+	dest->dpc = dpc;
+	dest->t15 = -1;
+	dest->t16 = -1;
+	dest->hnext = ss7->dest_hash[route_hash(dpc)];
+	/* ISUP shards look destinations up without locking */
+	__sync_synchronize();
+	ss7->dest_hash[route_hash(dpc)] = dest;
+
+	return dest;
+}
+
+/* Free the destination once nothing is configured for it anymore */
+static void mtp3_check_dest(struct ss7 *ss7, struct mtp3_dest *dest)
+{
+	struct mtp3_dest **d;
+
+	if (dest->numroutes || dest->relay || dest->learned)
+		return;
+
+	for (d = &ss7->dest_hash[route_hash(dest->dpc)]; *d != dest; d = &(*d)->hnext)
+		;
+	*d = dest->hnext;
+	free(dest);
+}
+
+int ss7_set_route(struct ss7 *ss7, unsigned int dpc, unsigned int adjpc, int priority)
+{
+	struct mtp3_dest *dest;
+	int i;
+
+	if (!ss7)
+		return -1;
+
+	if (priority < 0) {
+		dest = mtp3_find_dest(ss7, dpc);
+		if (!dest)
+			return 0;
+		for (i = 0; i < dest->numroutes && dest->adjpc[i] != adjpc; i++)
+			;
+		if (i == dest->numroutes)
+			return 0;
+		dest->numroutes--;
+		dest->adjpc[i] = dest->adjpc[dest->numroutes];
+		dest->priority[i] = dest->priority[dest->numroutes];
+		dest->sls_map_mask = 0;
+		mtp3_check_dest(ss7, dest);
+		return 0;
+	}
+
+	dest = mtp3_new_dest(ss7, dpc);
+	if (!dest)
+		return -1;
+
+	for (i = 0; i < dest->numroutes && dest->adjpc[i] != adjpc; i++)
+		;
+	if (i == dest->numroutes) {
+		if (dest->numroutes == SS7_MAX_ADJSPS) {
+			ss7_error(ss7, "Destination %d already has %d routes\n", dpc, SS7_MAX_ADJSPS);
+			return -1;
+		}
+		dest->adjpc[dest->numroutes++] = adjpc;
+	}
+	dest->priority[i] = priority;
+	/* Force a rebuild of the SLS map */
+	dest->sls_map_mask = 0;
+
+	return 0;
+}
+
+int ss7_set_relay(struct ss7 *ss7, unsigned int dpc, struct ss7 *out)
+{
+	struct mtp3_dest *dest;
+
+	if (!ss7)
+		return -1;
+
+	if (!out) {
+		dest = mtp3_find_dest(ss7, dpc);
+		if (dest) {
+			dest->relay = NULL;
+			mtp3_check_dest(ss7, dest);
+		}
+		return 0;
+	}
+
+	if (dpc == ss7->pc) {
+		ss7_error(ss7, "Cannot relay our own point code %d\n", dpc);
+		return -1;
+	}
+
+	dest = mtp3_new_dest(ss7, dpc);
+	if (!dest)
+		return -1;
+
+	dest->relay = out;
+
+	return 0;
+}
+
+void mtp3_destroy_all_dests(struct ss7 *ss7)
+{
+	struct mtp3_dest *next;
+	int i;
+
+	if (!ss7->dest_hash)
+		return;
+
+	for (i = 0; i < MTP3_ROUTE_HASH_SIZE; i++) {
+		while (ss7->dest_hash[i]) {
+			next = ss7->dest_hash[i]->hnext;
+			free(ss7->dest_hash[i]);
+			ss7->dest_hash[i] = next;
+		}
+	}
+	free(ss7->dest_hash);
+	ss7->dest_hash = NULL;
+}
+
 void mtp3_destroy_all_routes(struct adjecent_sp *adj_sp)
 {
 	struct mtp3_route *next;
@@ -134,6 +134,9 @@
 
 #define MTP3_TIMER_T10 18
 
+#define MTP3_TIMER_T15 19
+#define MTP3_TIMER_T16 20
+
 #define AUTORL(rl, link) 			\
 	struct routing_label rl;			\
 	rl.sls = link->net_mng_sls;						\
@@ -162,6 +165,8 @@ struct net_mng_message {
 #define TFR_NON_ACTIVE 3
 #define TFR_ACTIVE 4
 
+#define MTP3_ROUTE_HASH_SIZE	64
+
 struct mtp3_route {
 	int state;
 	unsigned int dpc;
@@ -170,6 +175,7 @@ struct mtp3_route {
 	struct ss7_msg *q;
 	struct adjecent_sp *owner;
 	struct mtp3_route *next;
+	struct mtp3_route *hnext;	/* route_hash chain */
 };
 
 struct adjecent_sp {
@@ -182,6 +188,29 @@ struct adjecent_sp {
 	unsigned int tra;
 	struct ss7 *master;
 	struct mtp3_route *routes;
+	/* The same routes indexed by full point code */
+	struct mtp3_route *route_hash[MTP3_ROUTE_HASH_SIZE];
+};
+
+/* Static routing data of a destination reachable over several adjacent SPs */
+struct mtp3_dest {
+	unsigned int dpc;
+	unsigned int adjpc[SS7_MAX_ADJSPS];
+	int priority[SS7_MAX_ADJSPS];
+	int numroutes;
+	/* SLS map over the links of the best available priority */
+	unsigned char sls_map[SS7_SLS_MAP_SIZE];
+	unsigned int sls_map_mask;
+	/* Linkset MSUs for the destination are relayed to, see ss7_set_relay() */
+	struct ss7 *relay;
+	/* Route set congestion status from TFC, see mtp3_dest_congestion() */
+	int cong_status;
+	int t15;
+	int t16;
+	struct mtp2 *cong_link;
+	unsigned int cong_discards;
+	int learned;		/* created by a TFC, never freed before ss7_destroy() */
+	struct mtp3_dest *hnext;
 };
 
 int net_mng_send(struct mtp2 *link, unsigned char h0h1, struct routing_label rl, unsigned int param);
@@ -217,4 +246,12 @@ void mtp3_free_co(struct mtp2 *link);
 
 void mtp3_destroy_all_routes(struct adjecent_sp *adj_sp);
 
+void mtp3_destroy_all_dests(struct ss7 *ss7);
+
+int mtp3_relay(struct ss7 *ss7, struct routing_label rl, struct ss7_msg *m);
+
+int mtp3_msu_priority(struct ss7 *ss7, struct ss7_msg *m);
+
+int mtp3_dest_congestion(struct ss7 *ss7, unsigned int dpc);
+
 #endif /* _MTP3_H */
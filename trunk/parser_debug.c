@@ -30,58 +30,858 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
 #include "libss7.h"
 #include "ss7_internal.h"
 #include "mtp2.h"
 #include "isup.h"
 #include "mtp3.h"
 
+/*
+ * Offline replay of MTP2 frames.
+ *
+ * The input is either a pcap file (MTP2 or MTP2 with pseudo header link
+ * types, as written by ss7_capture_start()) or a text file holding one
+ * frame per line as hex octets without the FCS.  Every frame is pushed
+ * through mtp2_receive() and on up the stack, the link being kept in
+ * service and in sequence, and the decode cost is accounted per message
+ * type.  With -j the replay runs on several independent linksets at once,
+ * one thread each, to measure how the stack scales across cores.  With -r
+ * we act as an STP: the MSUs are relayed to a second linkset instead of
+ * being taken, to measure the relay throughput.  With -c the first user
+ * part MSU of the file is buffered that many times on a link which then
+ * fails, to measure how fast changeover diverts the traffic.
+ */
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_LINKTYPE_MTP2_WITH_PHDR	139
+#define PCAP_LINKTYPE_MTP2	140
+
+#define REPLAY_FD_BASE		10
+
+/* FISU, LSSU, one per service indicator and one per ISUP message type */
+#define CLASS_FISU		0
+#define CLASS_LSSU		1
+#define CLASS_SI		2
+#define CLASS_ISUP		(CLASS_SI + 16)
+#define CLASS_MAX		(CLASS_ISUP + 256)
+
+#define MAX_EVENT_TYPES		64
+
+struct replay_frame {
+	struct timeval tv;
+	int slc;
+	int dir;
+	int len;
+	unsigned char *buf;
+};
+
+struct class_stats {
+	unsigned long count;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+};
+
+/* One linkset replaying the frames */
+struct replay {
+	struct ss7 *ss7;
+	pthread_t thread;
+	int res;
+	unsigned int adjpc;
+	unsigned long replayed;
+	unsigned long errors;
+	unsigned long generated;
+	/* Linkset the MSUs are relayed to with -r */
+	struct ss7 *out;
+	unsigned long relayed;
+	unsigned long long elapsed;
+	struct class_stats class_stats[CLASS_MAX];
+	unsigned long event_count[MAX_EVENT_TYPES];
+};
+
+/* Loaded and set before any replay starts, read only afterwards */
+static struct replay_frame *frames;
+static int numframes;
+static int quiet;
+static int ss7type;
+static int loops = 1;
+static int paced;
+static int replay_dir = SS7_FRAME_RX;
+static int deferred;
+static int relay;
+static int changeover;
+static int verbose = -1;
+
+static void replay_message(struct ss7 *ss7, char *s)
+{
+	if (!quiet)
+		fputs(s, stdout);
+}
+
+static void replay_error(struct ss7 *ss7, char *s)
+{
+	struct replay *r = ss7_get_userdata(ss7);
+
+	r->errors++;
+	if (!quiet)
+		fputs(s, stdout);
+}
+
+static void replay_notinservice(struct ss7 *ss7, int cic, unsigned int dpc)
+{
+}
+
+static int replay_hangup(struct ss7 *ss7, int cic, unsigned int dpc, int cause, int do_hangup)
+{
+	return SS7_CIC_NOT_EXISTS;
+}
+
+static void replay_call_null(struct ss7 *ss7, struct isup_call *c, int lock)
+{
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int add_frame(struct timeval *tv, int slc, int dir, unsigned char *buf, int len)
+{
+	struct replay_frame *f;
+
+	if (!(numframes % 1024)) {
+		f = realloc(frames, (numframes + 1024) * sizeof(*f));
+		if (!f)
+			return -1;
+		frames = f;
+	}
+
+	f = &frames[numframes];
+	/* Room for the FCS mtp2_receive() strips */
+	f->buf = calloc(1, len + 2);
+	if (!f->buf)
+		return -1;
+	memcpy(f->buf, buf, len);
+	f->len = len + 2;
+	f->slc = slc;
+	f->dir = dir;
+	f->tv = *tv;
+	numframes++;
+
+	return 0;
+}
+
+static uint32_t swap32(uint32_t x)
+{
+	return ((x & 0xff) << 24) | ((x & 0xff00) << 8) | ((x >> 8) & 0xff00) | (x >> 24);
+}
+
+static int load_pcap(FILE *fp)
+{
+	uint32_t fh[6], rh[4];
+	unsigned char buf[65536];
+	struct timeval tv;
+	int swapped = 0, nsec = 0, linktype, i, slc, dir, hdr;
+
+	if (fread(fh, sizeof(fh), 1, fp) != 1)
+		return -1;
+
+	if (fh[0] == swap32(PCAP_MAGIC) || fh[0] == swap32(PCAP_MAGIC_NSEC))
+		swapped = 1;
+	if (fh[0] == PCAP_MAGIC_NSEC || fh[0] == swap32(PCAP_MAGIC_NSEC))
+		nsec = 1;
+
+	linktype = swapped ? swap32(fh[5]) : fh[5];
+	if (linktype == PCAP_LINKTYPE_MTP2_WITH_PHDR)
+		hdr = 4;
+	else if (linktype == PCAP_LINKTYPE_MTP2)
+		hdr = 0;
+	else {
+		fprintf(stderr, "Unsupported pcap link type %d\n", linktype);
+		return -1;
+	}
+
+	while (fread(rh, sizeof(rh), 1, fp) == 1) {
+		if (swapped) {
+			for (i = 0; i < 4; i++)
+				rh[i] = swap32(rh[i]);
+		}
+		if (rh[2] > sizeof(buf) || fread(buf, rh[2], 1, fp) != 1) {
+			fprintf(stderr, "Truncated pcap record\n");
+			return -1;
+		}
+		if (rh[2] < hdr + MTP2_SIZE)
+			continue;
+
+		tv.tv_sec = rh[0];
+		tv.tv_usec = nsec ? rh[1] / 1000 : rh[1];
+		slc = hdr ? ((buf[2] << 8) | buf[3]) : 0;
+		dir = hdr ? (buf[0] ? SS7_FRAME_TX : SS7_FRAME_RX) : SS7_FRAME_RX;
+
+		if (add_frame(&tv, slc, dir, buf + hdr, rh[2] - hdr))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int load_hex(FILE *fp)
+{
+	char line[4096], *p, *end;
+	unsigned char buf[1024];
+	struct timeval tv;
+	int len;
+
+	gettimeofday(&tv, NULL);
+
+	while (fgets(line, sizeof(line), fp)) {
+		len = 0;
+		p = line;
+		while (len < sizeof(buf)) {
+			buf[len] = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+			len++;
+			p = end;
+		}
+		if (len && add_frame(&tv, 0, SS7_FRAME_RX, buf, len))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int frame_class(struct ss7 *ss7, unsigned char *buf, int len)
+{
+	struct mtp_su_head *h = (struct mtp_su_head *)buf;
+	int si, off;
+
+	if (h->li == 0)
+		return CLASS_FISU;
+	if (h->li < 3)
+		return CLASS_LSSU;
+
+	si = buf[MTP2_SIZE] & 0x0f;
+	if (si != SIG_ISUP)
+		return CLASS_SI + si;
+
+	/* MTP2 header, SIO, routing label and CIC */
+	off = MTP2_SIZE + 1 + ((ss7->switchtype == SS7_ITU) ? 4 : 7) + 2;
+	if (off >= len - 2)
+		return CLASS_SI + si;
+
+	return CLASS_ISUP + buf[off];
+}
+
+static char * class2str(int class, char *tmp)
+{
+	switch (class) {
+		case CLASS_FISU:
+			return "FISU";
+		case CLASS_LSSU:
+			return "LSSU";
+		case CLASS_SI + SIG_NET_MNG:
+			return "SNM";
+		case CLASS_SI + SIG_STD_TEST:
+			return "STD TEST";
+		case CLASS_SI + SIG_SPEC_TEST:
+			return "SPEC TEST";
+		case CLASS_SI + SIG_SCCP:
+			return "SCCP";
+	}
+
+	if (class >= CLASS_ISUP)
+		sprintf(tmp, "ISUP %s (0x%02x)", isup_message2str(class - CLASS_ISUP), class - CLASS_ISUP);
+	else
+		sprintf(tmp, "SI %d", class - CLASS_SI);
+
+	return tmp;
+}
+
+/* Learn our point code, the adjacent point code and the NI from an MSU */
+static void learn_pcs(struct ss7 *ss7, unsigned char *buf, unsigned int *adjpc)
+{
+	unsigned char *sif = buf + MTP2_SIZE + 1;
+
+	ss7->ni = buf[MTP2_SIZE] >> 6;
+
+	if (ss7->switchtype == SS7_ITU) {
+		ss7->pc = sif[0] | ((sif[1] & 0x3f) << 8);
+		*adjpc = ((sif[1] >> 6) & 0x3) | (sif[2] << 2) | ((sif[3] & 0xf) << 10);
+	} else {
+		ss7->pc = sif[0] | (sif[1] << 8) | (sif[2] << 16);
+		*adjpc = sif[3] | (sif[4] << 8) | (sif[5] << 16);
+	}
+}
+
+static struct mtp2 * replay_link(struct ss7 *ss7, int slc, unsigned int adjpc)
+{
+	struct mtp2 *link;
+	int idx = slc % SS7_MAX_LINKS;
+
+	while (ss7->numlinks <= idx) {
+		if (ss7_add_link(ss7, SS7_TRANSPORT_DAHDIDCHAN, REPLAY_FD_BASE + ss7->numlinks))
+			return NULL;
+		ss7_set_adjpc(ss7, REPLAY_FD_BASE + ss7->numlinks - 1, adjpc);
+	}
+
+	/* Keep the link and the adjacent SP up whatever the replayed traffic did to them */
+	link = ss7->links[idx];
+	link->state = MTP_INSERVICE;
+	link->std_test_passed = 1;
+	ss7->mtp2_linkstate[idx] = MTP2_LINKSTATE_UP;
+	if (link->adj_sp)
+		link->adj_sp->state = MTP3_UP;
+	ss7->state = SS7_STATE_UP;
+
+	return link;
+}
+
+/* Put the link in sequence with the frame so it is accepted */
+static void replay_sequence(struct mtp2 *link, unsigned char *buf)
+{
+	struct mtp_su_head *h = (struct mtp_su_head *)buf;
+
+	link->curfib = h->bib;
+	link->curbib = h->fib;
+	if (h->li > 2)
+		link->lastfsnacked = (h->fsn + 127) % 128;
+	else
+		link->lastfsnacked = h->fsn;
+	link->lastsurxd = -1;
+}
+
+static void drain(struct replay *r)
+{
+	struct ss7 *ss7 = r->ss7;
+	ss7_event *e;
+	struct ss7_msg *m;
+	int i;
+
+	while ((e = ss7_check_event(ss7))) {
+		if (e->e >= 0 && e->e < MAX_EVENT_TYPES)
+			r->event_count[e->e]++;
+		switch (e->e) {
+			case ISUP_EVENT_REL:
+				/* Answer like a switch would, isup_rlc() frees the call itself on failure */
+				if (isup_rlc(ss7, e->rel.call) > -1)
+					isup_free_call(ss7, e->rel.call);
+				break;
+			case ISUP_EVENT_RLC:
+				isup_free_call(ss7, e->rlc.call);
+				break;
+		}
+	}
+
+	/* Nothing is ever written in a replay, throw away what the stack sent */
+	for (i = 0; i < ss7->numlinks; i++) {
+		while ((m = ss7->links[i]->tx_q)) {
+			ss7->links[i]->tx_q = m->next;
+			ss7_msg_free(m);
+			r->generated++;
+		}
+		mtp2_tx_q_update(ss7->links[i]);
+	}
+
+	if (!r->out)
+		return;
+
+	for (i = 0; i < r->out->numlinks; i++) {
+		while ((m = r->out->links[i]->tx_q)) {
+			r->out->links[i]->tx_q = m->next;
+			ss7_msg_free(m);
+			r->relayed++;
+		}
+		mtp2_tx_q_update(r->out->links[i]);
+	}
+}
+
+/* The frames are for another SP now, reached over a linkset of its own */
+static int relay_setup(struct replay *r)
+{
+	struct ss7 *ss7 = r->ss7;
+	unsigned int dpc = ss7->pc;
+
+	/* Any point code but the two of the replayed traffic */
+	ss7->pc = dpc + 1;
+	if (ss7->pc == r->adjpc)
+		ss7->pc++;
+
+	r->out = ss7_new(ss7type);
+	if (!r->out)
+		return -1;
+
+	r->out->ni = ss7->ni;
+	r->out->pc = ss7->pc;
+	ss7_set_callbacks(r->out, &ss7->cb);
+	if (!replay_link(r->out, 0, dpc))
+		return -1;
+
+	return ss7_set_relay(ss7, dpc, r->out);
+}
+
+static int replay_setup(struct replay *r)
+{
+	struct ss7_callbacks cb = {
+		.message = replay_message,
+		.error = replay_error,
+		.notinservice = replay_notinservice,
+		.hangup = replay_hangup,
+		.call_null = replay_call_null,
+	};
+	int i;
+
+	r->ss7 = ss7_new(ss7type);
+	if (!r->ss7)
+		return -1;
+
+	ss7_set_callbacks(r->ss7, &cb);
+	ss7_set_userdata(r->ss7, r);
+
+	if (verbose)
+		r->ss7->debug = SS7_DEBUG_MTP2 | SS7_DEBUG_MTP3 | SS7_DEBUG_ISUP;
+
+	if (deferred && ss7_trace_start(r->ss7, numframes))
+		return -1;
+
+	for (i = 0; i < numframes; i++) {
+		if (frames[i].dir == replay_dir && ((struct mtp_su_head *)frames[i].buf)->li > 2) {
+			learn_pcs(r->ss7, frames[i].buf, &r->adjpc);
+			break;
+		}
+	}
+
+	if (relay)
+		return relay_setup(r);
+
+	return 0;
+}
+
+static void * replay_run(void *data)
+{
+	struct replay *r = data;
+	struct ss7 *ss7 = r->ss7;
+	struct replay_frame *f;
+	struct mtp2 *link;
+	unsigned long long start, loopstart, t;
+	int i, class, n;
+
+	start = now_ns();
+
+	for (n = 0; n < loops; n++) {
+		loopstart = now_ns();
+		for (i = 0; i < numframes; i++) {
+			f = &frames[i];
+			if (f->dir != replay_dir)
+				continue;
+
+			if (paced) {
+				long long due = (f->tv.tv_sec - frames[0].tv.tv_sec) * 1000000LL + (f->tv.tv_usec - frames[0].tv.tv_usec);
+				long long now = (now_ns() - loopstart) / 1000;
+				if (due > now)
+					usleep(due - now);
+				ss7_schedule_run(ss7);
+			}
+
+			link = replay_link(ss7, f->slc, r->adjpc);
+			if (!link) {
+				r->res = -1;
+				return NULL;
+			}
+			replay_sequence(link, f->buf);
+
+			class = frame_class(ss7, f->buf, f->len);
+			/* Where ss7_read() would have put it, so relaying needs no copy */
+			if (!ss7->rx_msg)
+				ss7->rx_msg = ss7_msg_new();
+			t = now_ns();
+			if (ss7->rx_msg && f->len <= sizeof(ss7->rx_msg->buf)) {
+				memcpy(ss7->rx_msg->buf, f->buf, f->len);
+				mtp2_receive(link, ss7->rx_msg->buf, f->len);
+			} else
+				mtp2_receive(link, f->buf, f->len);
+			t = now_ns() - t;
+
+			r->class_stats[class].count++;
+			r->class_stats[class].total_ns += t;
+			if (t > r->class_stats[class].max_ns)
+				r->class_stats[class].max_ns = t;
+			r->replayed++;
+
+			drain(r);
+		}
+		if (!paced)
+			ss7_schedule_run(ss7);
+		if (deferred) {
+			/* The decode is not part of the replay */
+			t = now_ns();
+			ss7_trace_process(ss7, 0);
+			start += now_ns() - t;
+		}
+	}
+
+	r->elapsed = now_ns() - start;
+
+	if (deferred)
+		ss7_trace_stop(ss7);
+
+	return NULL;
+}
+
+/* Link 0 fails with the retransmission buffer full and the rest of the
+ * MSUs queued, link 1 of the same linkset takes them over on COA */
+static int changeover_run(struct replay *r)
+{
+	struct ss7 *ss7 = r->ss7;
+	struct mtp2 *from, *to;
+	struct replay_frame *f = NULL;
+	struct routing_label rl;
+	struct ss7_msg *m;
+	ss7_event e;
+	unsigned char coa[16];
+	unsigned long long t;
+	unsigned int diverted = 0, misordered = 0, sls = 0, unacked = 0;
+	int i, si = 0, len;
+
+	for (i = 0; i < numframes; i++) {
+		if (frames[i].dir == replay_dir && ((struct mtp_su_head *)frames[i].buf)->li > 2 &&
+				(si = frames[i].buf[MTP2_SIZE] & 0x0f) > SIG_SCCP) {
+			f = &frames[i];
+			break;
+		}
+	}
+
+	if (!f) {
+		fprintf(stderr, "No user part MSU to buffer in the file\n");
+		return -1;
+	}
+
+	from = replay_link(ss7, 0, r->adjpc);
+	to = replay_link(ss7, 1, r->adjpc);
+	if (!from || !to)
+		return -1;
+
+	rl.type = ss7->switchtype;
+	rl.opc = ss7->pc;
+	rl.dpc = r->adjpc;
+
+	/* Everything goes over link 0 while link 1 is held down */
+	ss7->mtp2_linkstate[1] = MTP2_LINKSTATE_DOWN;
+	for (i = 0; i < changeover; i++) {
+		m = ss7_msg_new();
+		if (!m)
+			return -1;
+		memcpy(m->buf, f->buf, f->len);
+		m->size = f->len;
+		rl.sls = i & 0xf;
+		set_routinglabel(m->buf + MTP2_SIZE + SIO_SIZE, &rl);
+		mtp3_transmit(ss7, si, rl, m, NULL);
+	}
+	ss7->mtp2_linkstate[1] = MTP2_LINKSTATE_UP;
+
+	/* As many as MTP2 may have sent without an acknowledgement */
+	from->lastfsnacked = 0;
+	while ((m = from->tx_q) && unacked < 127) {
+		from->tx_q = m->next;
+		((struct mtp_su_head *)m->buf)->fsn = ++unacked;
+		m->next = from->tx_buf;
+		from->tx_buf = m;
+	}
+	mtp2_tx_q_update(from);
+
+	t = now_ns();
+
+	memset(&e, 0, sizeof(e));
+	e.e = MTP2_LINK_DOWN;
+	e.link.link = from;
+	mtp3_process_event(ss7, &e);
+
+	/* COA from the adjacent SP, nothing was received after FSN 0 */
+	coa[0] = (ss7->ni << 6) | SIG_NET_MNG;
+	rl.opc = r->adjpc;
+	rl.dpc = ss7->pc;
+	rl.sls = from->slc;
+	set_routinglabel(coa + SIO_SIZE, &rl);
+	len = SIO_SIZE + ((ss7->switchtype == SS7_ITU) ? 4 : 7);
+	coa[len++] = (NET_MNG_COA);
+	coa[len++] = 0;
+	mtp3_receive(ss7, to, coa, len);
+
+	t = now_ns() - t;
+
+	for (m = to->tx_q; m; m = m->next) {
+		if (m->userpart <= SIG_SCCP)
+			continue;
+		if (m->sls != (sls++ & 0xf))
+			misordered++;
+		diverted++;
+	}
+
+	printf("Changeover of %d MSUs (%u unacknowledged) in %.3f ms: %.0f MSUs/s\n", changeover, unacked,
+		t / 1e6, t ? diverted * 1e9 / t : 0.0);
+	printf("MSUs diverted: %u, out of sequence: %u\n", diverted, misordered);
+
+	ss7_destroy(ss7);
+	return (diverted == changeover && !misordered) ? 0 : -1;
+}
+
+/* Linksets replaying the same frames end up alike unless they share state */
+static int replay_diverged(struct replay *a, struct replay *b)
+{
+	return a->replayed != b->replayed || a->errors != b->errors || a->generated != b->generated ||
+		a->relayed != b->relayed || memcmp(a->event_count, b->event_count, sizeof(a->event_count));
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [-n loops] [-j threads] [-p] [-t] [-d] [-r] [-c msus] [-q|-v] ansi|itu file\n"
+		"  -n loops  replay the file this many times\n"
+		"  -j threads replay on this many linksets in parallel, one thread each,\n"
+		"            and fail if their results differ\n"
+		"  -p        replay at the recorded pace instead of as fast as possible\n"
+		"  -t        replay the frames we transmitted instead of those we received\n"
+		"  -d        defer the protocol debug decode until after each pass\n"
+		"  -r        relay the MSUs to another linkset, as an STP would\n"
+		"  -c msus   time a changeover with this many MSUs buffered on the failed link\n"
+		"  -q        no protocol debug output (default for pcap input)\n"
+		"  -v        full protocol debug output (default for hex input)\n", name);
+}
+
 int main(int argc, char **argv)
 {
 	FILE *fp;
+	struct replay *replays, *r, total;
+	uint32_t magic = 0;
+	int opt, i, j, threads = 1;
+	unsigned long long start, elapsed;
 	struct ss7 *ss7;
-	unsigned char mybuf[512];
-	unsigned int tmp;
-	int ss7type;
-	int res = 0, i = 0, size;
-	ss7_event *e;
+	struct isup_stats isup;
+	struct isup_latency lat;
+	struct ss7_profile prof;
+	char tmp[64];
 
-	if (argc != 3)
+	while ((opt = getopt(argc, argv, "n:j:ptdrc:qv")) != -1) {
+		switch (opt) {
+			case 'n':
+				loops = atoi(optarg);
+				break;
+			case 'j':
+				threads = atoi(optarg);
+				if (threads < 1)
+					threads = 1;
+				break;
+			case 'p':
+				paced = 1;
+				break;
+			case 't':
+				replay_dir = SS7_FRAME_TX;
+				break;
+			case 'd':
+				deferred = 1;
+				break;
+			case 'r':
+				relay = 1;
+				break;
+			case 'c':
+				changeover = atoi(optarg);
+				break;
+			case 'q':
+				verbose = 0;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return -1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
 		return -1;
+	}
 
-	if (!strcasecmp(argv[1], "ansi"))
+	if (!strcasecmp(argv[optind], "ansi"))
 		ss7type = SS7_ANSI;
-	else if (!strcasecmp(argv[1], "itu"))
+	else if (!strcasecmp(argv[optind], "itu"))
 		ss7type = SS7_ITU;
-	else
+	else {
+		usage(argv[0]);
 		return -1;
+	}
 
-	ss7 = ss7_new(ss7type);
+	fp = fopen(argv[optind + 1], "r");
+	if (!fp) {
+		perror(argv[optind + 1]);
+		return -1;
+	}
 
-	fp = fopen(argv[2], "r");
+	if (fread(&magic, sizeof(magic), 1, fp) != 1)
+		magic = 0;
+	rewind(fp);
 
-	while (res != EOF) {
-		res = fscanf(fp, "%x ", &tmp);
-		mybuf[i++] = (unsigned char) tmp;
+	if (magic == PCAP_MAGIC || magic == swap32(PCAP_MAGIC) || magic == PCAP_MAGIC_NSEC || magic == swap32(PCAP_MAGIC_NSEC)) {
+		if (load_pcap(fp))
+			return -1;
+		if (verbose < 0)
+			verbose = 0;
+	} else {
+		if (load_hex(fp))
+			return -1;
+		if (verbose < 0)
+			verbose = 1;
 	}
+	fclose(fp);
+
+	quiet = !verbose;
+
+	replays = calloc(threads, sizeof(*replays));
+	if (!replays)
+		return -1;
+
+	for (j = 0; j < threads; j++) {
+		if (replay_setup(&replays[j]))
+			return -1;
+	}
+
+	if (changeover > 0)
+		return changeover_run(&replays[0]);
 
-	size = i + 1;
+	start = now_ns();
 
-	for (i = 0; i < size; i++) {
-		printf("%.2x ", mybuf[i]);
+	if (threads == 1)
+		replay_run(&replays[0]);
+	else {
+		for (j = 0; j < threads; j++) {
+			if (pthread_create(&replays[j].thread, NULL, replay_run, &replays[j])) {
+				fprintf(stderr, "Unable to start replay thread\n");
+				return -1;
+			}
+		}
+		for (j = 0; j < threads; j++)
+			pthread_join(replays[j].thread, NULL);
 	}
 
+	elapsed = now_ns() - start;
+
+	memset(&total, 0, sizeof(total));
+	for (j = 0; j < threads; j++) {
+		r = &replays[j];
+		if (r->res)
+			return -1;
+		total.replayed += r->replayed;
+		total.errors += r->errors;
+		total.generated += r->generated;
+		total.relayed += r->relayed;
+		for (i = 0; i < CLASS_MAX; i++) {
+			total.class_stats[i].count += r->class_stats[i].count;
+			total.class_stats[i].total_ns += r->class_stats[i].total_ns;
+			if (r->class_stats[i].max_ns > total.class_stats[i].max_ns)
+				total.class_stats[i].max_ns = r->class_stats[i].max_ns;
+		}
+		for (i = 0; i < MAX_EVENT_TYPES; i++)
+			total.event_count[i] += r->event_count[i];
+		/* Timers fire at different moments in a paced replay */
+		if (!paced && replay_diverged(r, &replays[0])) {
+			fprintf(stderr, "Linkset %d diverged from linkset 0, linksets are sharing state\n", j);
+			return -1;
+		}
+		if (threads > 1)
+			printf("Linkset %d: %lu frames in %.3f s: %.0f frames/s\n", j, r->replayed,
+				r->elapsed / 1e9, r->elapsed ? r->replayed * 1e9 / r->elapsed : 0.0);
+	}
+	/* A single replay leaves out the deferred decode */
+	if (threads == 1)
+		elapsed = replays[0].elapsed;
+
+	printf("Replayed %lu frames of %d in %.3f s: %.0f frames/s\n", total.replayed, numframes,
+		elapsed / 1e9, elapsed ? total.replayed * 1e9 / elapsed : 0.0);
+	printf("Errors reported: %lu, MSUs generated: %lu\n", total.errors, total.generated);
+	if (relay)
+		printf("MSUs relayed: %lu, %.0f MSUs/s\n", total.relayed, elapsed ? total.relayed * 1e9 / elapsed : 0.0);
 	printf("\n");
 
-	ss7_add_link(ss7, SS7_TRANSPORT_DAHDIDCHAN, 10);
+	printf("%-28s %10s %12s %12s\n", "Type", "Count", "Avg (ns)", "Max (ns)");
+	for (i = 0; i < CLASS_MAX; i++) {
+		if (!total.class_stats[i].count)
+			continue;
+		printf("%-28s %10lu %12llu %12llu\n", class2str(i, tmp), total.class_stats[i].count,
+			total.class_stats[i].total_ns / total.class_stats[i].count, total.class_stats[i].max_ns);
+	}
+
+	printf("\n%-28s %10s\n", "Event", "Count");
+	for (i = 0; i < MAX_EVENT_TYPES; i++) {
+		if (!total.event_count[i])
+			continue;
+		if (strcmp(ss7_event2str(i), "Unknown Event"))
+			printf("%-28s %10lu\n", ss7_event2str(i), total.event_count[i]);
+		else {
+			sprintf(tmp, "Event %d", i);
+			printf("%-28s %10lu\n", tmp, total.event_count[i]);
+		}
+	}
+
+	/* Protocol figures of the first linkset */
+	ss7 = replays[0].ss7;
+
+	if (!isup_get_stats(ss7, &isup)) {
+		printf("\n%-28s %10s\n", "Release cause received", "Count");
+		for (i = 0; i < 128; i++) {
+			if (isup.rel_cause_rx[i])
+				printf("%-28d %10lu\n", i, isup.rel_cause_rx[i]);
+		}
+	}
 
-	ss7->debug = SS7_DEBUG_MTP2 | SS7_DEBUG_MTP3 | SS7_DEBUG_ISUP;
-	ss7->links[0]->state = MTP_INSERVICE;
+	if (!isup_get_latency(ss7, &lat, 0)) {
+		printf("\n%-28s %10s %12s %12s\n", "Procedure", "Count", "Avg (us)", "Max (us)");
+		for (i = 0; i < ISUP_LAT_MAX; i++) {
+			if (!lat.proc[i].count)
+				continue;
+			printf("%-28s %10lu %12llu %12lu\n", isup_latency2str(i), lat.proc[i].count,
+				lat.proc[i].sum / lat.proc[i].count, lat.proc[i].max);
+		}
+	}
 
-	mtp2_receive(ss7->links[0], mybuf, size);
+	if (!ss7_get_profile(ss7, &prof, 0)) {
+		printf("\n%-28s %10s %12s %12s\n", "Layer", "Calls", prof.tsc ? "Avg (cyc)" : "Avg (ns)", prof.tsc ? "Max (cyc)" : "Max (ns)");
+		for (i = 0; i < SS7_PROF_LAYERS; i++) {
+			if (prof.layer[i].calls)
+				printf("%-28s %10lu %12llu %12llu\n", ss7_prof_layer2str(i), prof.layer[i].calls,
+					prof.layer[i].ticks / prof.layer[i].calls, prof.layer[i].max);
+		}
+		for (i = 0; i < 256; i++) {
+			if (prof.isup_decode[i].calls) {
+				sprintf(tmp, "  decode %s", isup_message2str(i));
+				printf("%-28s %10lu %12llu %12llu\n", tmp, prof.isup_decode[i].calls,
+					prof.isup_decode[i].ticks / prof.isup_decode[i].calls, prof.isup_decode[i].max);
+			}
+		}
+		for (i = 0; i < 256; i++) {
+			if (prof.isup_encode[i].calls) {
+				sprintf(tmp, "  encode %s", isup_message2str(i));
+				printf("%-28s %10lu %12llu %12llu\n", tmp, prof.isup_encode[i].calls,
+					prof.isup_encode[i].ticks / prof.isup_encode[i].calls, prof.isup_encode[i].max);
+			}
+		}
+	}
 
-	e = ss7_check_event(ss7);
+	for (j = 0; j < threads; j++) {
+		ss7_destroy(replays[j].ss7);
+		if (replays[j].out)
+			ss7_destroy(replays[j].out);
+	}
+	free(replays);
 
 	return 0;
 }
@@ -44,33 +44,88 @@
 #include "mtp3.h"
 
 
-static void (*__ss7_message)(struct ss7 *ss7, char *message);
-static void (*__ss7_error)(struct ss7 *ss7, char *message);
+/* Only read by ss7_new(), running linksets use their own copy */
+static struct ss7_callbacks default_callbacks;
 
 void ss7_set_message(void (*func)(struct ss7 *ss7, char *message))
 {
-	__ss7_message = func;
+	default_callbacks.message = func;
 }
 
 void ss7_set_error(void (*func)(struct ss7 *ss7, char *message))
 {
-	__ss7_error = func;
+	default_callbacks.error = func;
 }
 
 void ss7_set_notinservice(void (*func)(struct ss7 *ss7, int cic, unsigned int dpc))
 {
-	ss7_notinservice = func;
+	default_callbacks.notinservice = func;
 }
 
 void ss7_set_hangup(int (*func)(struct ss7 *ss7, int cic, unsigned int dpc, int cause, int do_hangup))
 {
-	ss7_hangup = func;
+	default_callbacks.hangup = func;
 }
 
 /* not called in normal operation */
 void ss7_set_call_null(void (*func)(struct ss7 *ss7, struct isup_call *c, int lock))
 {
-	ss7_call_null = func;
+	default_callbacks.call_null = func;
+}
+
+void ss7_set_callbacks(struct ss7 *ss7, const struct ss7_callbacks *cb)
+{
+	if (!ss7 || !cb)
+		return;
+
+	ss7->cb = *cb;
+}
+
+void ss7_set_userdata(struct ss7 *ss7, void *data)
+{
+	if (!ss7)
+		return;
+
+	ss7->userdata = data;
+}
+
+void * ss7_get_userdata(struct ss7 *ss7)
+{
+	return ss7 ? ss7->userdata : NULL;
+}
+
+void ss7_notinservice(struct ss7 *ss7, int cic, unsigned int dpc)
+{
+	if (!ss7->cb.notinservice)
+		return;
+
+	SS7_PROF_ENTER(ss7);
+	ss7->cb.notinservice(ss7, cic, dpc);
+	SS7_PROF_LEAVE(ss7, SS7_PROF_APP, -1);
+}
+
+int ss7_hangup(struct ss7 *ss7, int cic, unsigned int dpc, int cause, int do_hangup)
+{
+	int res;
+
+	if (!ss7->cb.hangup)
+		return SS7_CIC_NOT_EXISTS;
+
+	SS7_PROF_ENTER(ss7);
+	res = ss7->cb.hangup(ss7, cic, dpc, cause, do_hangup);
+	SS7_PROF_LEAVE(ss7, SS7_PROF_APP, -1);
+
+	return res;
+}
+
+void ss7_call_null(struct ss7 *ss7, struct isup_call *c, int lock)
+{
+	if (!ss7->cb.call_null)
+		return;
+
+	SS7_PROF_ENTER(ss7);
+	ss7->cb.call_null(ss7, c, lock);
+	SS7_PROF_LEAVE(ss7, SS7_PROF_APP, -1);
 }
 
 void ss7_message(struct ss7 *ss7, char *fmt, ...)
@@ -81,9 +136,11 @@ void ss7_message(struct ss7 *ss7, char *fmt, ...)
 	va_start(ap, fmt);
 	vsnprintf(tmp, sizeof(tmp), fmt, ap);
 	va_end(ap);
-	if (__ss7_message)
-		__ss7_message(ss7, tmp);
-	else
+	if (ss7->cb.message) {
+		SS7_PROF_ENTER(ss7);
+		ss7->cb.message(ss7, tmp);
+		SS7_PROF_LEAVE(ss7, SS7_PROF_APP, -1);
+	} else
 		fputs(tmp, stdout);
 }
 
@@ -95,9 +152,11 @@ void ss7_error(struct ss7 *ss7, char *fmt, ...)
 	va_start(ap, fmt);
 	vsnprintf(tmp, sizeof(tmp), fmt, ap);
 	va_end(ap);
-	if (__ss7_error)
-		__ss7_error(ss7, tmp);
-	else
+	if (ss7->cb.error) {
+		SS7_PROF_ENTER(ss7);
+		ss7->cb.error(ss7, tmp);
+		SS7_PROF_LEAVE(ss7, SS7_PROF_APP, -1);
+	} else
 		fputs(tmp, stdout);
 }
 
@@ -257,6 +316,43 @@ int ss7_pollflags(struct ss7 *ss7, int fd)
 	return flags;
 }
 
+int ss7_set_congestion_thresholds(struct ss7 *ss7, int level, unsigned int onset, unsigned int abate, unsigned int discard)
+{
+	if (!ss7)
+		return -1;
+
+	if (level < 1 || level > 3 || !onset || !abate || abate >= onset || (discard && discard < onset)) {
+		ss7_error(ss7, "Invalid congestion thresholds for level %d\n", level);
+		return -1;
+	}
+
+	ss7->cong_onset[level] = onset;
+	ss7->cong_abate[level] = abate;
+	ss7->cong_discard[level] = discard;
+
+	return 0;
+}
+
+int ss7_get_congestion(struct ss7 *ss7)
+{
+	if (!ss7)
+		return 0;
+
+	/* ISUP shards ask their linkset */
+	if (ss7->parent)
+		ss7 = ss7->parent;
+
+	return ss7->cong_level;
+}
+
+int ss7_get_dpc_congestion(struct ss7 *ss7, unsigned int dpc)
+{
+	if (!ss7)
+		return 0;
+
+	return mtp3_dest_congestion(ss7, dpc);
+}
+
 /* TODO: Add entry to routing table instead */
 int ss7_set_adjpc(struct ss7 *ss7, int fd, unsigned int pc)
 {
@@ -315,6 +411,10 @@ char * ss7_event2str(int event)
 			return "ISUP_EVENT_SAM";
 		case ISUP_EVENT_DIGITTIMEOUT:
 			return "ISUP_EVENT_DIGITTIMEOUT";
+		case SS7_EVENT_CONGESTION:
+			return "SS7_EVENT_CONGESTION";
+		case SS7_EVENT_DPC_CONGESTION:
+			return "SS7_EVENT_DPC_CONGESTION";
 		default:
 			return "Unknown Event";
 	}
@@ -351,6 +451,8 @@ struct ss7 *ss7_new(int switchtype)
 	s->flags = SS7_ISDN_ACCES_INDICATOR;
 	s->sls_shift = 0;
 	s->cause_location = LOC_PRIV_NET_LOCAL_USER;
+	s->call_gap_shares = 1;
+	s->cb = default_callbacks;
 
 	return s;
 }
@@ -362,14 +464,25 @@ void ss7_destroy(struct ss7 *ss7)
 	if (!ss7)
 		return;
 
+	ss7_thread_stop(ss7);
+	ss7_destroy(ss7->mtp2_timers);
+	ss7_capture_stop(ss7);
+	ss7_trace_free(ss7);
+	ss7_shm_free(ss7);
+	ss7_screen_clear(ss7);
+
 	/* ISUP */
 	isup_free_all_calls(ss7);
+	isup_free_all_dpcs(ss7);
+	isup_free_call_snapshot(ss7);
 	
 	/* MTP3 */
 	for (i = 0; i > ss7->numsps; i++) {
 		mtp3_destroy_all_routes(ss7->adj_sps[i]);
 		free(ss7->adj_sps[i]);
 	}
+	mtp3_destroy_all_dests(ss7);
+	ss7_msg_free(ss7->rx_msg);
 	
 	for (i = 0; i > ss7->numlinks; i++) {
 		flush_bufs(ss7->links[i]);
@@ -431,7 +544,7 @@ int ss7_write(struct ss7 *ss7, int fd)
 
 int ss7_read(struct ss7 *ss7, int fd)
 {
-	unsigned char buf[1024];
+	struct ss7_msg *m;
 	int res;
 	int winner = -1;
 	int i;
@@ -446,16 +559,204 @@ int ss7_read(struct ss7 *ss7, int fd)
 	if (winner < 0)
 		return -1;
 
-	res = read(ss7->links[winner]->fd, buf, sizeof(buf));
+	/* Read straight into a message buffer, so a relayed MSU needs no copy */
+	if (!ss7->rx_msg && !(ss7->rx_msg = ss7_msg_new()))
+		return -1;
+	m = ss7->rx_msg;
+
+	res = read(ss7->links[winner]->fd, m->buf, sizeof(m->buf));
 	if (res <= 0) {
 		return res;
 	}
 
-	res = mtp2_receive(ss7->links[winner], buf, res);
+	res = mtp2_receive(ss7->links[winner], m->buf, res);
 
 	return res;
 }
 
+static const char * const prof_layer_names[SS7_PROF_LAYERS] = {
+	"MTP2 receive", "MTP2 transmit", "MTP3 receive", "MTP3 net mng",
+	"MTP3 routing", "ISUP decode", "ISUP encode", "Application",
+};
+
+const char * ss7_prof_layer2str(int layer)
+{
+	if (layer < 0 || layer >= SS7_PROF_LAYERS)
+		return "Unknown";
+
+	return prof_layer_names[layer];
+}
+
+#ifdef SS7_PROFILE
+static inline void prof_add(struct ss7_prof_entry *e, unsigned long long ticks)
+{
+	e->calls++;
+	e->ticks += ticks;
+	if (ticks > e->max)
+		e->max = ticks;
+}
+
+/* Closes the innermost SS7_PROF_ENTER(), what the nested layers used is left out */
+void ss7_prof_leave(struct ss7 *ss7, int layer, int type)
+{
+	struct ss7_prof_state *p = &ss7->prof;
+	unsigned long long total;
+	int d = --p->depth;
+
+	if (d >= SS7_PROF_DEPTH || d < 0)
+		return;
+
+	total = ss7_prof_ticks() - p->start[d];
+	if (d > 0)
+		p->child[d - 1] += total;
+	total -= p->child[d];
+
+	prof_add(&p->data.layer[layer], total);
+	if (type < 0)
+		return;
+	if (layer == SS7_PROF_ISUP_DECODE)
+		prof_add(&p->data.isup_decode[type & 0xff], total);
+	else if (layer == SS7_PROF_ISUP_ENCODE)
+		prof_add(&p->data.isup_encode[type & 0xff], total);
+}
+#endif
+
+int ss7_get_profile(struct ss7 *ss7, struct ss7_profile *prof, int reset)
+{
+#ifdef SS7_PROFILE
+	if (!ss7 || !prof)
+		return -1;
+
+	*prof = ss7->prof.data;
+#if defined(__i386__) || defined(__x86_64__)
+	prof->tsc = 1;
+#endif
+	if (reset)
+		memset(&ss7->prof.data, 0, sizeof(ss7->prof.data));
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+long ss7_tvdiff_usec(struct timeval *end, struct timeval *start)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+void ss7_hist_add(struct ss7_hist *h, long usec)
+{
+	int b = 0;
+
+	/* Clock stepped back */
+	if (usec < 0)
+		usec = 0;
+
+	while (b < SS7_HIST_BUCKETS - 1 && (usec >> b))
+		b++;
+
+	h->count++;
+	h->sum += usec;
+	if ((unsigned long) usec > h->max)
+		h->max = usec;
+	h->bucket[b]++;
+}
+
+void ss7_hist_merge(struct ss7_hist *to, struct ss7_hist *from)
+{
+	int b;
+
+	to->count += from->count;
+	to->sum += from->sum;
+	if (from->max > to->max)
+		to->max = from->max;
+	for (b = 0; b < SS7_HIST_BUCKETS; b++)
+		to->bucket[b] += from->bucket[b];
+}
+
+int ss7_get_link_stats(struct ss7 *ss7, int slc, struct ss7_link_stats *stats)
+{
+	int i;
+
+	if (!ss7 || !stats)
+		return -1;
+
+	for (i = 0; i < ss7->numlinks; i++) {
+		if (ss7->links[i]->slc == slc) {
+			mtp2_get_stats(ss7->links[i], stats);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int ss7_get_linkset_stats(struct ss7 *ss7, struct ss7_link_stats *stats)
+{
+	struct ss7_link_stats ls;
+	int i;
+
+	if (!ss7 || !stats)
+		return -1;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->slc = -1;
+
+	for (i = 0; i < ss7->numlinks; i++) {
+		mtp2_get_stats(ss7->links[i], &ls);
+		stats->inservice += ls.inservice;
+		stats->msu_tx += ls.msu_tx;
+		stats->msu_rx += ls.msu_rx;
+		stats->octets_tx += ls.octets_tx;
+		stats->octets_rx += ls.octets_rx;
+		stats->fisu_tx += ls.fisu_tx;
+		stats->fisu_rx += ls.fisu_rx;
+		stats->lssu_tx += ls.lssu_tx;
+		stats->lssu_rx += ls.lssu_rx;
+		stats->retransmitted += ls.retransmitted;
+		stats->nack_tx += ls.nack_tx;
+		stats->nack_rx += ls.nack_rx;
+		stats->t7_expiries += ls.t7_expiries;
+		stats->align_attempts += ls.align_attempts;
+		stats->align_failures += ls.align_failures;
+		stats->changeovers += ls.changeovers;
+		stats->changebacks += ls.changebacks;
+		stats->inservice_time += ls.inservice_time;
+		if (ls.period > stats->period)
+			stats->period = ls.period;
+		stats->tx_q_depth += ls.tx_q_depth;
+		stats->tx_buf_depth += ls.tx_buf_depth;
+		stats->occupancy_tx += ls.occupancy_tx;
+		stats->occupancy_rx += ls.occupancy_rx;
+		if (ls.tx_buf_age > stats->tx_buf_age)
+			stats->tx_buf_age = ls.tx_buf_age;
+		ss7_hist_merge(&stats->queue_delay, &ls.queue_delay);
+		ss7_hist_merge(&stats->ack_rtt, &ls.ack_rtt);
+		stats->ls_msus += ls.ls_msus;
+		stats->sls_codes += ls.sls_codes;
+		stats->relayed += ls.relayed;
+		stats->screened += ls.screened;
+		if (ls.cong_level > stats->cong_level)
+			stats->cong_level = ls.cong_level;
+		stats->cong_onsets += ls.cong_onsets;
+		stats->cong_discards += ls.cong_discards;
+	}
+
+	return 0;
+}
+
+void ss7_reset_link_stats(struct ss7 *ss7)
+{
+	int i;
+
+	if (!ss7)
+		return;
+
+	for (i = 0; i < ss7->numlinks; i++)
+		mtp2_reset_stats(ss7->links[i]);
+}
+
 static inline char * changeover2str(int state)
 {
 	switch(state) {
@@ -567,13 +868,34 @@ void ss7_show_linkset(struct ss7 *ss7, void (* cust_printf)(int fd, const char *
 	struct adjecent_sp *adj_sp;
 	struct mtp2 *link;
 	struct mtp3_route *cur;
+	struct mtp3_dest *dest;
+	struct ss7_link_stats stats;
 	
 	cust_printf(fd, "Switch type: %s\n", (ss7->switchtype == SS7_ITU) ? "ITU" : "ANSI");
 	cust_printf(fd, "Our point code: %i\n", ss7->pc);
 	cust_printf(fd, "SLS shift: %i\n", ss7->sls_shift);
 	cust_printf(fd, "numlinks: %i\n", ss7->numlinks);
 	cust_printf(fd, "numsps: %i\n", ss7->numsps);
+	if (ss7->sched_stats.lateness.count)
+		cust_printf(fd, "Timer lateness: avg %llu max %lu us over %lu timers, %u at most per run\n",
+				ss7->sched_stats.lateness.sum / ss7->sched_stats.lateness.count, ss7->sched_stats.lateness.max,
+				ss7->sched_stats.callbacks, ss7->sched_stats.max_callbacks);
+
+
+	if (ss7->dest_hash) {
+		cust_printf(fd, "Destinations:\n");
+		cust_printf(fd, "    DPC  CONG  DISCARDS  Adjecent SP(priority)\n");
+		for (j = 0; j < MTP3_ROUTE_HASH_SIZE; j++) {
+			for (dest = ss7->dest_hash[j]; dest; dest = dest->hnext) {
+				cust_printf(fd, "%7i  %4i  %8u  ", dest->dpc, dest->cong_status, dest->cong_discards);
+				for (i = 0; i < dest->numroutes; i++)
+					cust_printf(fd, " %i(%i)", dest->adjpc[i], dest->priority[i]);
+				cust_printf(fd, "\n");
+			}
+		}
+	}
 
+	ss7_screen_show(ss7, cust_printf, fd);
 
 	for (j = 0; j < ss7->numsps; j++) {
 		adj_sp = ss7->adj_sps[j];
@@ -617,6 +939,34 @@ void ss7_show_linkset(struct ss7 *ss7, void (* cust_printf)(int fd, const char *
 			cust_printf(fd, "    CB buffer:  %i\n", len_buf(link->cb_buf));
 			cust_printf(fd, "    Last FSN:   %i\n", link->lastfsnacked);
 			cust_printf(fd, "    MTP3timers: %s\n", timers);
+
+			mtp2_get_stats(link, &stats);
+			cust_printf(fd, "    Statistics over %lus:\n", stats.period);
+			cust_printf(fd, "      MSU tx/rx:        %lu/%lu (%llu/%llu octets)\n", stats.msu_tx, stats.msu_rx, stats.octets_tx, stats.octets_rx);
+			cust_printf(fd, "      FISU tx/rx:       %lu/%lu\n", stats.fisu_tx, stats.fisu_rx);
+			cust_printf(fd, "      LSSU tx/rx:       %lu/%lu\n", stats.lssu_tx, stats.lssu_rx);
+			cust_printf(fd, "      Retransmitted:    %lu  NACK tx/rx: %lu/%lu  T7 expiries: %lu\n",
+					stats.retransmitted, stats.nack_tx, stats.nack_rx, stats.t7_expiries);
+			cust_printf(fd, "      Alignments:       %lu (%lu failed)\n", stats.align_attempts, stats.align_failures);
+			cust_printf(fd, "      Changeover/back:  %lu/%lu\n", stats.changeovers, stats.changebacks);
+			cust_printf(fd, "      In service:       %lus\n", stats.inservice_time);
+			cust_printf(fd, "      Occupancy tx/rx:  %.3f/%.3f Erl\n", stats.occupancy_tx, stats.occupancy_rx);
+			if (stats.queue_delay.count)
+				cust_printf(fd, "      Queue delay:      avg %llu max %lu us\n",
+						stats.queue_delay.sum / stats.queue_delay.count, stats.queue_delay.max);
+			if (stats.ack_rtt.count)
+				cust_printf(fd, "      Ack RTT:          avg %llu max %lu us\n",
+						stats.ack_rtt.sum / stats.ack_rtt.count, stats.ack_rtt.max);
+			if (stats.tx_buf_depth)
+				cust_printf(fd, "      Oldest unacked:   %lu ms\n", stats.tx_buf_age);
+			cust_printf(fd, "      Load sharing:     %u SLS, %lu MSUs\n", stats.sls_codes, stats.ls_msus);
+			if (stats.relayed)
+				cust_printf(fd, "      Relayed:          %lu\n", stats.relayed);
+			if (stats.screened)
+				cust_printf(fd, "      Screened out:     %lu\n", stats.screened);
+			if (stats.cong_onsets)
+				cust_printf(fd, "      Congestion:       level %u, %lu onsets, %lu discarded\n",
+						stats.cong_level, stats.cong_onsets, stats.cong_discards);
 		} /* links */
 	} /* sps */
 }
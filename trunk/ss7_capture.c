@@ -0,0 +1,402 @@
+/*
+ * libss7: An implementation of Signalling System 7
+ *
+ * Raw MTP2 frame capture to pcap files and deferred debug tracing
+ *
+ * All Rights Reserved.
+ */
+
+/*
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2 as published by the
+ * Free Software Foundation. See the LICENSE file included with
+ * this program for more details.
+ *
+ * In addition, when this program is distributed with Asterisk in
+ * any form that would qualify as a 'combined work' or as a
+ * 'derivative work' (but not mere aggregation), you can redistribute
+ * and/or modify the combination under the terms of the license
+ * provided with that copy of Asterisk, instead of the license
+ * terms granted here.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include "libss7.h"
+#include "ss7_internal.h"
+#include "mtp2.h"
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_VERSION_MAJOR	2
+#define PCAP_VERSION_MINOR	4
+/* LINKTYPE_MTP2_WITH_PHDR: 4 byte pseudo header followed by the MTP2 frame without FCS */
+#define PCAP_LINKTYPE_MTP2_WITH_PHDR	139
+
+#define SS7_CAPTURE_DEFAULT_FRAMES	4096
+#define SS7_TRACE_DEFAULT_FRAMES	4096
+#define SS7_RING_MAX_FRAMES		(1 << 20)
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec_header {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+struct pcap_mtp2_phdr {
+	uint8_t sent;
+	uint8_t annex_a_used;
+	uint8_t link_number[2]; /* network byte order */
+};
+
+struct ss7_frame_ring * ss7_ring_new(unsigned int size)
+{
+	struct ss7_frame_ring *ring;
+	unsigned int x = 1;
+
+	if (size > SS7_RING_MAX_FRAMES)
+		size = SS7_RING_MAX_FRAMES;
+
+	while (x < size)
+		x <<= 1;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->frames = calloc(x, sizeof(struct ss7_frame));
+	if (!ring->frames) {
+		free(ring);
+		return NULL;
+	}
+	ring->size = x;
+
+	return ring;
+}
+
+void ss7_ring_free(struct ss7_frame_ring *ring)
+{
+	if (!ring)
+		return;
+	free(ring->frames);
+	free(ring);
+}
+
+/* Producer side, never blocks: a full ring just counts the frame as dropped */
+int ss7_ring_put(struct ss7_frame_ring *ring, int slc, int dir, unsigned char *buf, int len)
+{
+	struct ss7_frame *f;
+	unsigned int head = ring->head;
+
+	if (head - ring->tail >= ring->size) {
+		ring->dropped++;
+		return -1;
+	}
+
+	if (len > SS7_FRAME_MAX)
+		len = SS7_FRAME_MAX;
+	if (len < 0)
+		len = 0;
+
+	f = &ring->frames[head & (ring->size - 1)];
+	gettimeofday(&f->tv, NULL);
+	f->slc = slc;
+	f->dir = dir;
+	f->len = len;
+	memcpy(f->buf, buf, len);
+
+	/* Make the frame visible before publishing the new head */
+	__sync_synchronize();
+	ring->head = head + 1;
+
+	return 0;
+}
+
+/* Consumer side */
+struct ss7_frame * ss7_ring_peek(struct ss7_frame_ring *ring)
+{
+	unsigned int tail = ring->tail;
+
+	if (tail == ring->head)
+		return NULL;
+
+	__sync_synchronize();
+	return &ring->frames[tail & (ring->size - 1)];
+}
+
+void ss7_ring_advance(struct ss7_frame_ring *ring)
+{
+	__sync_synchronize();
+	ring->tail = ring->tail + 1;
+}
+
+/* Consumers on other threads hold a reference while they use the capture
+ * or the trace, stopping detaches them first and waits for those threads */
+static inline void ring_users_get(struct ss7 *ss7)
+{
+	__sync_fetch_and_add(&ss7->ring_users, 1);
+}
+
+static inline void ring_users_put(struct ss7 *ss7)
+{
+	__sync_fetch_and_sub(&ss7->ring_users, 1);
+}
+
+static void ring_users_wait(struct ss7 *ss7)
+{
+	__sync_synchronize();
+	while (ss7->ring_users)
+		sched_yield();
+}
+
+void ss7_capture_frame(struct ss7 *ss7, int slc, int dir, unsigned char *buf, int len)
+{
+	struct ss7_capture *cap = ss7->capture;
+
+	if (!cap || !cap->enabled)
+		return;
+
+	ss7_ring_put(cap->ring, slc, dir, buf, len);
+}
+
+int ss7_capture_start(struct ss7 *ss7, const char *filename, unsigned int frames)
+{
+	struct ss7_capture *cap;
+	struct pcap_file_header fh;
+
+	if (!ss7 || !filename)
+		return -1;
+
+	if (ss7->capture) {
+		ss7_error(ss7, "Capture already running\n");
+		return -1;
+	}
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return -1;
+
+	cap->ring = ss7_ring_new(frames ? frames : SS7_CAPTURE_DEFAULT_FRAMES);
+	if (!cap->ring) {
+		free(cap);
+		return -1;
+	}
+
+	cap->fp = fopen(filename, "w");
+	if (!cap->fp) {
+		ss7_error(ss7, "Unable to open capture file %s\n", filename);
+		ss7_ring_free(cap->ring);
+		free(cap);
+		return -1;
+	}
+
+	memset(&fh, 0, sizeof(fh));
+	fh.magic = PCAP_MAGIC;
+	fh.version_major = PCAP_VERSION_MAJOR;
+	fh.version_minor = PCAP_VERSION_MINOR;
+	fh.snaplen = SS7_FRAME_MAX + sizeof(struct pcap_mtp2_phdr);
+	fh.linktype = PCAP_LINKTYPE_MTP2_WITH_PHDR;
+
+	if (fwrite(&fh, sizeof(fh), 1, cap->fp) != 1) {
+		ss7_error(ss7, "Unable to write capture file header\n");
+		fclose(cap->fp);
+		ss7_ring_free(cap->ring);
+		free(cap);
+		return -1;
+	}
+
+	cap->enabled = 1;
+	ss7->capture = cap;
+
+	return 0;
+}
+
+void ss7_capture_enable(struct ss7 *ss7, int enable)
+{
+	if (!ss7)
+		return;
+
+	ring_users_get(ss7);
+	if (ss7->capture)
+		ss7->capture->enabled = enable ? 1 : 0;
+	ring_users_put(ss7);
+}
+
+static int capture_write(struct ss7 *ss7, struct ss7_capture *cap)
+{
+	struct ss7_frame *f;
+	struct pcap_rec_header rh;
+	struct pcap_mtp2_phdr ph;
+	int res = 0;
+
+	while ((f = ss7_ring_peek(cap->ring))) {
+		rh.ts_sec = f->tv.tv_sec;
+		rh.ts_usec = f->tv.tv_usec;
+		rh.incl_len = rh.orig_len = f->len + sizeof(ph);
+
+		ph.sent = (f->dir == SS7_FRAME_TX) ? 1 : 0;
+		ph.annex_a_used = 0;
+		ph.link_number[0] = 0;
+		ph.link_number[1] = f->slc;
+
+		if ((fwrite(&rh, sizeof(rh), 1, cap->fp) != 1) || (fwrite(&ph, sizeof(ph), 1, cap->fp) != 1) ||
+				(f->len && fwrite(f->buf, f->len, 1, cap->fp) != 1)) {
+			ss7_error(ss7, "Error writing capture file\n");
+			return -1;
+		}
+
+		ss7_ring_advance(cap->ring);
+		cap->written++;
+		res++;
+	}
+
+	fflush(cap->fp);
+
+	return res;
+}
+
+int ss7_capture_flush(struct ss7 *ss7)
+{
+	int res = -1;
+
+	if (!ss7)
+		return -1;
+
+	ring_users_get(ss7);
+	if (ss7->capture)
+		res = capture_write(ss7, ss7->capture);
+	ring_users_put(ss7);
+
+	return res;
+}
+
+unsigned int ss7_capture_dropped(struct ss7 *ss7)
+{
+	unsigned int dropped = 0;
+
+	if (!ss7)
+		return 0;
+
+	ring_users_get(ss7);
+	if (ss7->capture)
+		dropped = ss7->capture->ring->dropped;
+	ring_users_put(ss7);
+
+	return dropped;
+}
+
+void ss7_capture_stop(struct ss7 *ss7)
+{
+	struct ss7_capture *cap;
+
+	if (!ss7 || !ss7->capture)
+		return;
+
+	cap = ss7->capture;
+	cap->enabled = 0;
+	ss7->capture = NULL;
+	ring_users_wait(ss7);
+
+	capture_write(ss7, cap);
+	fclose(cap->fp);
+	ss7_ring_free(cap->ring);
+	free(cap);
+}
+
+int ss7_trace_start(struct ss7 *ss7, unsigned int frames)
+{
+	if (!ss7)
+		return -1;
+
+	if (ss7->trace)
+		return 0;
+
+	ss7->trace = ss7_ring_new(frames ? frames : SS7_TRACE_DEFAULT_FRAMES);
+	if (!ss7->trace) {
+		ss7_error(ss7, "Unable to allocate trace buffer\n");
+		return -1;
+	}
+	ss7->trace_dropped = 0;
+
+	return 0;
+}
+
+static int trace_decode(struct ss7 *ss7, struct ss7_frame_ring *ring, int max)
+{
+	struct ss7_frame *f;
+	unsigned int dropped;
+	int res = 0;
+
+	dropped = ring->dropped;
+	if (dropped != ss7->trace_dropped) {
+		ss7_message(ss7, "Trace buffer overflow, %u record(s) lost\n", dropped - ss7->trace_dropped);
+		ss7->trace_dropped = dropped;
+	}
+
+	while ((!max || res < max) && (f = ss7_ring_peek(ring))) {
+		ss7_message(ss7, "-- %ld.%06ld --\n", (long) f->tv.tv_sec, (long) f->tv.tv_usec);
+		mtp2_dump_su(ss7, f->slc, (f->dir == SS7_FRAME_TX) ? '>' : '<', f->buf, f->len);
+		ss7_ring_advance(ring);
+		res++;
+	}
+
+	return res;
+}
+
+int ss7_trace_process(struct ss7 *ss7, int max)
+{
+	int res = -1;
+
+	if (!ss7)
+		return -1;
+
+	ring_users_get(ss7);
+	if (ss7->trace)
+		res = trace_decode(ss7, ss7->trace, max);
+	ring_users_put(ss7);
+
+	return res;
+}
+
+void ss7_trace_free(struct ss7 *ss7)
+{
+	struct ss7_frame_ring *ring = ss7->trace;
+
+	ss7->trace = NULL;
+	ring_users_wait(ss7);
+	ss7_ring_free(ring);
+}
+
+void ss7_trace_stop(struct ss7 *ss7)
+{
+	struct ss7_frame_ring *ring;
+
+	if (!ss7 || !ss7->trace)
+		return;
+
+	ring = ss7->trace;
+	ss7->trace = NULL;
+	ring_users_wait(ss7);
+
+	trace_decode(ss7, ring, 0);
+	ss7_ring_free(ring);
+}
@@ -53,9 +53,54 @@
 /* User Information layer 1 protocol types */
 #define ISUP_L1PROT_G711ULAW 0x02
 
+#ifdef SS7_PROFILE
+#include <time.h>
+
+/* Layer nesting we keep track of, deeper calls are not timed */
+#define SS7_PROF_DEPTH		8
+
+struct ss7_prof_state {
+	int depth;
+	unsigned long long start[SS7_PROF_DEPTH];
+	unsigned long long child[SS7_PROF_DEPTH];
+	struct ss7_profile data;
+};
+
+static inline unsigned long long ss7_prof_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int lo, hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long) hi << 32) | lo;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#define SS7_PROF_ENTER(ss7) do { \
+	struct ss7_prof_state *__p = &(ss7)->prof; \
+	if (__p->depth < SS7_PROF_DEPTH) { \
+		__p->child[__p->depth] = 0; \
+		__p->start[__p->depth] = ss7_prof_ticks(); \
+	} \
+	__p->depth++; \
+} while (0)
+
+#define SS7_PROF_LEAVE(ss7, layer, type) ss7_prof_leave(ss7, layer, type)
+#else
+#define SS7_PROF_ENTER(ss7) do { } while (0)
+#define SS7_PROF_LEAVE(ss7, layer, type) do { } while (0)
+#endif
+
 #define MAX_EVENTS		16
 #define MAX_SCHED		512 /* need a lot cause of isup timers... */
-#define SS7_MAX_LINKS		4
+#define SS7_MAX_LINKS		8
+/* 4 bit ITU SLS, up to 8 bit ANSI SLS */
+#define SS7_SLS_MAP_SIZE	256
 #define SS7_MAX_ADJSPS		4
 
 #define SS7_STATE_DOWN	0
@@ -67,6 +112,9 @@
 /* MTP3 timers */
 #define MTP3_MAX_TIMERS 32
 
+/* Buckets of the per DPC ISUP table */
+#define ISUP_DPC_HASH_SIZE 64
+
 #define LOC_PRIV_NET_LOCAL_USER 0x1
 
 typedef unsigned int point_code;
@@ -82,6 +130,12 @@ struct ss7_msg {
 	unsigned char buf[512];
 	unsigned int size;
 	struct ss7_msg *next;
+	struct timeval queued;	/* handed to MTP2 */
+	struct timeval sent;	/* first transmitted on the current link */
+	unsigned char retransmitted;	/* its acknowledgement time is ambiguous */
+	unsigned int dpc;	/* label and user part set by MTP3, so changeover */
+	unsigned char sls;	/* can reroute the MSU without parsing it again */
+	unsigned char userpart;
 };
 
 struct ss7_sched {
@@ -90,8 +144,50 @@ struct ss7_sched {
 	void *data;
 };
 
+/* Largest raw MTP2 frame we keep in a frame ring, FCS excluded */
+#define SS7_FRAME_MAX		280
+
+#define SS7_FRAME_RX		0
+#define SS7_FRAME_TX		1
+
+struct ss7_frame {
+	struct timeval tv;
+	unsigned short len;
+	unsigned char slc;
+	unsigned char dir;
+	unsigned char buf[SS7_FRAME_MAX];
+};
+
+/* Token bucket, 'tokens' in millionths of a call */
+struct ss7_bucket {
+	unsigned int rate;	/* calls per second, 0 for no limit */
+	unsigned int burst;
+	unsigned long long tokens;
+	struct timeval last;
+};
+
+/* Single producer (protocol thread), single consumer ring of raw frames */
+struct ss7_frame_ring {
+	unsigned int size; /* always a power of two */
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	volatile unsigned int dropped;
+	struct ss7_frame *frames;
+};
+
+struct ss7_capture {
+	FILE *fp;
+	volatile int enabled;
+	unsigned int written;
+	struct ss7_frame_ring *ring;
+};
+
 struct ss7 {
 	unsigned int switchtype;
+
+	/* Application callbacks and data, nothing is shared between instances */
+	struct ss7_callbacks cb;
+	void *userdata;
 	unsigned int numsps;
 	unsigned int numlinks;
 
@@ -110,10 +206,26 @@ struct ss7 {
 	ss7_event ev_q[MAX_EVENTS];
 
 	struct ss7_sched ss7_sched[MAX_SCHED];
+	struct ss7_sched_stats sched_stats;
+	unsigned int sched_warn_usec;
 	struct isup_call *calls;
+	unsigned int numcalls;	/* on the calls list, read by other threads */
 
 	unsigned int mtp2_linkstate[SS7_MAX_LINKS];
 	struct mtp2 *links[SS7_MAX_LINKS];
+	/* SLS load sharing, rebuilt whenever the usable links change */
+	unsigned char sls_map[SS7_SLS_MAP_SIZE];
+	unsigned int sls_map_mask;
+	/* Destinations with configured route priorities, see ss7_set_route() */
+	struct mtp3_dest **dest_hash;
+	/* Congestion thresholds of levels 1 to 3 on the link transmit queues,
+	 * and the highest level of the links */
+	unsigned int cong_onset[4];
+	unsigned int cong_abate[4];
+	unsigned int cong_discard[4];
+	volatile int cong_level;
+	/* Frame being received, kept by MTP3 when it relays the MSU */
+	struct ss7_msg *rx_msg;
 	struct adjecent_sp *adj_sps[SS7_MAX_ADJSPS];
 	int isup_timers[ISUP_MAX_TIMERS];
 	int mtp3_timers[MTP3_MAX_TIMERS];
@@ -122,6 +234,43 @@ struct ss7 {
 	unsigned char cb_seq;
 	int linkset_up_timer;
 	unsigned char cause_location;
+
+	/* Call gapping of outgoing IAMs, level 0 for all of them and 1 and 2
+	 * for a DPC at that ACL, and the inbound overload thresholds */
+	struct ss7_bucket call_gap[3];
+	unsigned int call_gap_shares;	/* ISUP shards gapping the same calls */
+	unsigned int overload[2];
+
+	/* ISUP counters, totals and per DPC */
+	struct isup_stats isup_stats;
+	struct isup_dpc *isup_dpcs[ISUP_DPC_HASH_SIZE];
+	struct isup_latency isup_latency;
+	struct isup_call_snapshot *call_snapshot;
+
+	/* pcap capture, NULL if never opened */
+	struct ss7_capture *capture;
+	/* Deferred debug trace, decoded by ss7_trace_process() */
+	struct ss7_frame_ring *trace;
+	unsigned int trace_dropped;
+	/* Threads flushing the capture or decoding the trace right now */
+	volatile int ring_users;
+	/* Shared memory statistics, NULL unless published */
+	struct ss7_shm_writer *shm;
+	/* Library owned protocol thread, NULL unless started */
+	struct ss7_thread *thread;
+	/* ISUP shards of a threaded linkset and the linkset of a shard */
+	int numshards;
+	int shard_block;	/* CICs of a block kept on one shard */
+	struct ss7 **shards;
+	struct ss7 *parent;
+	/* Gateway screening, NULL unless rules were set */
+	struct ss7_screen *screen;
+	/* Scheduler of the MTP2 thread, see ss7_set_mtp2_thread() */
+	struct ss7 *mtp2_timers;
+
+#ifdef SS7_PROFILE
+	struct ss7_prof_state prof;
+#endif
 };
 
 /* Getto hacks for developmental purposes */
@@ -129,6 +278,13 @@ struct ss7_msg * ss7_msg_new(void);
 
 void ss7_msg_free(struct ss7_msg *m);
 
+/* Latency histograms */
+long ss7_tvdiff_usec(struct timeval *end, struct timeval *start);
+
+void ss7_hist_add(struct ss7_hist *h, long usec);
+
+void ss7_hist_merge(struct ss7_hist *to, struct ss7_hist *from);
+
 /* Scheduler functions */
 int ss7_schedule_event(struct ss7 *ss7, int ms, void (*function)(void *data), void *data);
 
@@ -148,10 +304,54 @@ void ss7_dump_buf(struct ss7 *ss7, int tabs,  unsigned char *buf, int len);
 
 void ss7_dump_msg(struct ss7 *ss7, unsigned char *buf, int len);
 
-void (*ss7_notinservice)(struct ss7 *ss7, int cic, unsigned int dpc);
+/* ISUP shards, see ss7_set_isup_shards() */
+int ss7_shard_receive(struct ss7 *ss7, struct routing_label *rl, unsigned char *buf, int len);
+
+int ss7_shard_transmit(struct ss7 *ss7, unsigned char userpart, struct routing_label rl, struct ss7_msg *m);
+
+/* Events not taken by the application yet */
+unsigned int ss7_event_backlog(struct ss7 *ss7);
+
+/* MSU received on the MTP2 thread, for MTP3 on the protocol thread */
+int ss7_mtp2_deliver(struct mtp2 *link, unsigned char *buf, int len);
+
+/* MSU queued for the MTP2 thread to send */
+void ss7_mtp2_kick(struct ss7 *ss7);
+
+/* MSU relayed to another linkset, on its protocol thread if it has one */
+int ss7_relay_transmit(struct ss7 *ss7, struct routing_label rl, struct ss7_msg *m);
+
+/* Frame rings */
+struct ss7_frame_ring * ss7_ring_new(unsigned int size);
+
+void ss7_ring_free(struct ss7_frame_ring *ring);
+
+int ss7_ring_put(struct ss7_frame_ring *ring, int slc, int dir, unsigned char *buf, int len);
+
+struct ss7_frame * ss7_ring_peek(struct ss7_frame_ring *ring);
+
+void ss7_ring_advance(struct ss7_frame_ring *ring);
+
+void ss7_capture_frame(struct ss7 *ss7, int slc, int dir, unsigned char *buf, int len);
+
+void ss7_trace_free(struct ss7 *ss7);
+
+void ss7_shm_free(struct ss7 *ss7);
+
+/* Gateway screening, SS7_SCREEN_ALLOW or SS7_SCREEN_DENY */
+int ss7_screen_msu(struct ss7 *ss7, unsigned char si, struct routing_label *rl, unsigned char *buf, int len);
+
+void ss7_screen_show(struct ss7 *ss7, void (* cust_printf)(int fd, const char *format, ...), int fd);
+
+#ifdef SS7_PROFILE
+void ss7_prof_leave(struct ss7 *ss7, int layer, int type);
+#endif
+
+/* Application callbacks */
+void ss7_notinservice(struct ss7 *ss7, int cic, unsigned int dpc);
 
-int (*ss7_hangup)(struct ss7 *ss7, int cic, unsigned int dpc, int cause, int do_hangup);
+int ss7_hangup(struct ss7 *ss7, int cic, unsigned int dpc, int cause, int do_hangup);
 
-void (*ss7_call_null)(struct ss7 *ss7, struct isup_call *c, int lock);
+void ss7_call_null(struct ss7 *ss7, struct isup_call *c, int lock);
 
 #endif /* _SS7_H */
@@ -33,6 +33,7 @@
 #include "ss7_internal.h"
 #include "mtp3.h"
 #include <stdio.h>
+#include <string.h>
 
 
 /* Scheduler routines */
@@ -60,7 +61,7 @@ int ss7_schedule_event(struct ss7 *ss7, int ms, void (*function)(void *data), vo
 	return x;
 }
 
-struct timeval *ss7_schedule_next(struct ss7 *ss7)
+static struct timeval *__ss7_schedule_next(struct ss7 *ss7)
 {
 	struct timeval *closest = NULL;
 	int x;
@@ -75,11 +76,32 @@ struct timeval *ss7_schedule_next(struct ss7 *ss7)
 	return closest;
 }
 
+/* Without ss7_thread_start() the MTP2 timers run with the linkset */
+static inline struct ss7 * ss7_mtp2_sched(struct ss7 *ss7)
+{
+	return (ss7->mtp2_timers && !ss7->thread) ? ss7->mtp2_timers : NULL;
+}
+
+struct timeval *ss7_schedule_next(struct ss7 *ss7)
+{
+	struct timeval *closest = __ss7_schedule_next(ss7), *mtp2;
+
+	if (ss7_mtp2_sched(ss7) && (mtp2 = __ss7_schedule_next(ss7->mtp2_timers)) &&
+			(!closest || timercmp(mtp2, closest, <)))
+		closest = mtp2;
+
+	return closest;
+}
+
 static int __ss7_schedule_run(struct ss7 *ss7, struct timeval *tv)
 {
 	int x;
 	void (*callback)(void *);
 	void *data;
+	struct timeval now;
+	long late, worst = 0;
+	unsigned int fired = 0;
+
 	for (x=1;x<MAX_SCHED;x++) {
 		if (ss7->ss7_sched[x].callback &&
 			((ss7->ss7_sched[x].when.tv_sec < tv->tv_sec) ||
@@ -89,9 +111,30 @@ static int __ss7_schedule_run(struct ss7 *ss7, struct timeval *tv)
 				data = ss7->ss7_sched[x].data;
 				ss7->ss7_sched[x].callback = NULL;
 				ss7->ss7_sched[x].data = NULL;
+
+				/* Earlier callbacks in this run add to the delay */
+				gettimeofday(&now, NULL);
+				late = ss7_tvdiff_usec(&now, &ss7->ss7_sched[x].when);
+				ss7_hist_add(&ss7->sched_stats.lateness, late);
+				if (late > worst)
+					worst = late;
+				fired++;
+
 				callback(data);
 		}
 	}
+
+	ss7->sched_stats.runs++;
+	ss7->sched_stats.callbacks += fired;
+	if (fired > ss7->sched_stats.max_callbacks)
+		ss7->sched_stats.max_callbacks = fired;
+
+	/* One warning per run at most, a stalled loop makes many timers late at once */
+	if (ss7->sched_warn_usec && worst > ss7->sched_warn_usec) {
+		ss7->sched_stats.late_warnings++;
+		ss7_error(ss7, "Scheduler running late: %u timer(s) fired, up to %ld ms behind\n", fired, worst / 1000);
+	}
+
 	return 0;
 }
 
@@ -103,10 +146,32 @@ int ss7_schedule_run(struct ss7 *ss7)
 	gettimeofday(&tv, NULL);
 
 	res =  __ss7_schedule_run(ss7, &tv);
+	if (ss7_mtp2_sched(ss7))
+		__ss7_schedule_run(ss7->mtp2_timers, &tv);
 
 	return res;
 }
 
+int ss7_get_sched_stats(struct ss7 *ss7, struct ss7_sched_stats *stats, int reset)
+{
+	if (!ss7 || !stats)
+		return -1;
+
+	*stats = ss7->sched_stats;
+	if (reset)
+		memset(&ss7->sched_stats, 0, sizeof(ss7->sched_stats));
+
+	return 0;
+}
+
+void ss7_set_sched_warning(struct ss7 *ss7, unsigned int ms)
+{
+	if (!ss7)
+		return;
+
+	ss7->sched_warn_usec = ms * 1000;
+}
+
 void ss7_schedule_del(struct ss7 *ss7, int *id)
 {
 	if ((*id >= MAX_SCHED)) 
@@ -0,0 +1,302 @@
+/*
+ * libss7: An implementation of Signalling System 7
+ *
+ * Gateway screening of received MSUs
+ *
+ * All Rights Reserved.
+ */
+
+/*
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2 as published by the
+ * Free Software Foundation. See the LICENSE file included with
+ * this program for more details.
+ *
+ * In addition, when this program is distributed with Asterisk in
+ * any form that would qualify as a 'combined work' or as a
+ * 'derivative work' (but not mere aggregation), you can redistribute
+ * and/or modify the combination under the terms of the license
+ * provided with that copy of Asterisk, instead of the license
+ * terms granted here.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "libss7.h"
+#include "ss7_internal.h"
+#include "mtp3.h"
+#include "isup.h"
+
+/*
+ * Rules are compiled into one set of matching rules per service indicator
+ * and, for each of OPC, DPC and CIC, a sorted list of intervals each
+ * holding the rules covering it.  An MSU is checked by ANDing the sets
+ * found for its fields, the first rule left deciding: no rule is walked.
+ */
+
+/* Values from 'start[i]' up to 'start[i + 1]' match 'rules[i]' */
+struct screen_ranges {
+	int num;
+	unsigned int start[SS7_SCREEN_MAX_RULES * 2 + 1];
+	uint64_t rules[SS7_SCREEN_MAX_RULES * 2 + 1];
+};
+
+struct ss7_screen {
+	int numrules;
+	struct ss7_screen_rule rule[SS7_SCREEN_MAX_RULES];
+	unsigned long hits[SS7_SCREEN_MAX_RULES];
+	int default_action;
+	unsigned long default_hits;
+
+	/* Compiled */
+	uint64_t si[16];
+	uint64_t no_cic;	/* rules without a CIC range, for other SIs */
+	struct screen_ranges opc;
+	struct screen_ranges dpc;
+	struct screen_ranges cic;
+};
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void ranges_build(struct screen_ranges *r, struct ss7_screen *s, int field)
+{
+	unsigned int min, max, v;
+	int i, j, n = 0;
+
+	r->start[n++] = 0;
+	for (i = 0; i < s->numrules; i++) {
+		switch (field) {
+			case 0:
+				min = s->rule[i].opc_min, max = s->rule[i].opc_max;
+				break;
+			case 1:
+				min = s->rule[i].dpc_min, max = s->rule[i].dpc_max;
+				break;
+			default:
+				if (s->rule[i].cic_min < 0)
+					continue;
+				min = s->rule[i].cic_min, max = s->rule[i].cic_max;
+				break;
+		}
+		r->start[n++] = min;
+		if (max != ~0U)
+			r->start[n++] = max + 1;
+	}
+
+	qsort(r->start, n, sizeof(r->start[0]), cmp_uint);
+	for (i = 1, j = 1; i < n; i++) {
+		if (r->start[i] != r->start[j - 1])
+			r->start[j++] = r->start[i];
+	}
+	r->num = j;
+
+	for (j = 0; j < r->num; j++) {
+		v = r->start[j];
+		r->rules[j] = 0;
+		for (i = 0; i < s->numrules; i++) {
+			switch (field) {
+				case 0:
+					min = s->rule[i].opc_min, max = s->rule[i].opc_max;
+					break;
+				case 1:
+					min = s->rule[i].dpc_min, max = s->rule[i].dpc_max;
+					break;
+				default:
+					if (s->rule[i].cic_min < 0)
+						continue;
+					min = s->rule[i].cic_min, max = s->rule[i].cic_max;
+					break;
+			}
+			if (v >= min && v <= max)
+				r->rules[j] |= 1ULL << i;
+		}
+	}
+}
+
+static inline uint64_t ranges_find(const struct screen_ranges *r, unsigned int v)
+{
+	int lo = 0, hi = r->num - 1, mid;
+
+	/* Last interval starting at or below 'v', the first one starts at 0 */
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (r->start[mid] <= v)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return r->rules[lo];
+}
+
+static void screen_compile(struct ss7_screen *s)
+{
+	int i, si;
+
+	memset(s->si, 0, sizeof(s->si));
+	s->no_cic = 0;
+
+	for (i = 0; i < s->numrules; i++) {
+		for (si = 0; si < 16; si++) {
+			if (!s->rule[i].si_mask || (s->rule[i].si_mask & (1 << si)))
+				s->si[si] |= 1ULL << i;
+		}
+		if (s->rule[i].cic_min < 0)
+			s->no_cic |= 1ULL << i;
+	}
+
+	ranges_build(&s->opc, s, 0);
+	ranges_build(&s->dpc, s, 1);
+	ranges_build(&s->cic, s, 2);
+}
+
+static struct ss7_screen * screen_get(struct ss7 *ss7)
+{
+	if (!ss7->screen) {
+		ss7->screen = calloc(1, sizeof(*ss7->screen));
+		if (!ss7->screen) {
+			ss7_error(ss7, "Unable to allocate screening rules\n");
+			return NULL;
+		}
+		ss7->screen->default_action = SS7_SCREEN_ALLOW;
+		screen_compile(ss7->screen);
+	}
+
+	return ss7->screen;
+}
+
+int ss7_screen_add(struct ss7 *ss7, const struct ss7_screen_rule *rule)
+{
+	struct ss7_screen *s;
+
+	if (!ss7 || !rule)
+		return -1;
+
+	if (rule->opc_min > rule->opc_max || rule->dpc_min > rule->dpc_max ||
+			(rule->cic_min >= 0 && rule->cic_min > rule->cic_max)) {
+		ss7_error(ss7, "Invalid screening rule ranges\n");
+		return -1;
+	}
+
+	s = screen_get(ss7);
+	if (!s)
+		return -1;
+
+	if (s->numrules == SS7_SCREEN_MAX_RULES) {
+		ss7_error(ss7, "Too many screening rules, %d at most\n", SS7_SCREEN_MAX_RULES);
+		return -1;
+	}
+
+	s->rule[s->numrules] = *rule;
+	s->hits[s->numrules] = 0;
+	s->numrules++;
+	screen_compile(s);
+
+	return s->numrules - 1;
+}
+
+int ss7_screen_default(struct ss7 *ss7, int action)
+{
+	struct ss7_screen *s;
+
+	if (!ss7)
+		return -1;
+
+	s = screen_get(ss7);
+	if (!s)
+		return -1;
+
+	s->default_action = action;
+
+	return 0;
+}
+
+unsigned long ss7_screen_hits(struct ss7 *ss7, int rule)
+{
+	if (!ss7 || !ss7->screen)
+		return 0;
+
+	if (rule < 0)
+		return ss7->screen->default_hits;
+
+	if (rule >= ss7->screen->numrules)
+		return 0;
+
+	return ss7->screen->hits[rule];
+}
+
+void ss7_screen_clear(struct ss7 *ss7)
+{
+	if (!ss7)
+		return;
+
+	free(ss7->screen);
+	ss7->screen = NULL;
+}
+
+int ss7_screen_msu(struct ss7 *ss7, unsigned char si, struct routing_label *rl, unsigned char *buf, int len)
+{
+	struct ss7_screen *s = ss7->screen;
+	struct isup_h *mh = (struct isup_h *) buf;
+	uint64_t match;
+	int cic, i;
+
+	match = s->si[si & 0xf] & ranges_find(&s->opc, rl->opc) & ranges_find(&s->dpc, rl->dpc);
+
+	if (si == SIG_ISUP && len >= CIC_SIZE) {
+		if (ss7->switchtype == SS7_ITU)
+			cic = mh->cic[0] | ((mh->cic[1] & 0x0f) << 8);
+		else
+			cic = mh->cic[0] | ((mh->cic[1] & 0x3f) << 8);
+		match &= s->no_cic | ranges_find(&s->cic, cic);
+	} else
+		match &= s->no_cic;
+
+	if (!match) {
+		s->default_hits++;
+		return s->default_action;
+	}
+
+	i = __builtin_ctzll(match);
+	s->hits[i]++;
+
+	return s->rule[i].action;
+}
+
+void ss7_screen_show(struct ss7 *ss7, void (* cust_printf)(int fd, const char *format, ...), int fd)
+{
+	struct ss7_screen *s = ss7->screen;
+	struct ss7_screen_rule *r;
+	char cic[32];
+	int i;
+
+	if (!s)
+		return;
+
+	cust_printf(fd, "Screening rules:\n");
+	cust_printf(fd, "     OPC             DPC             SI mask  CIC          Action  Hits\n");
+	for (i = 0; i < s->numrules; i++) {
+		r = &s->rule[i];
+		if (r->cic_min < 0)
+			strcpy(cic, "any");
+		else
+			snprintf(cic, sizeof(cic), "%d-%d", r->cic_min, r->cic_max);
+		cust_printf(fd, "  %2d %-7u-%-7u %-7u-%-7u %04x     %-12s %-7s %lu\n", i, r->opc_min, r->opc_max,
+				r->dpc_min, r->dpc_max, r->si_mask, cic, (r->action == SS7_SCREEN_DENY) ? "deny" : "allow", s->hits[i]);
+	}
+	cust_printf(fd, "  Default: %s, %lu hits\n", (s->default_action == SS7_SCREEN_DENY) ? "deny" : "allow", s->default_hits);
+}
@@ -0,0 +1,242 @@
+/*
+ * libss7: An implementation of Signalling System 7
+ *
+ * Statistics published in shared memory for external monitors
+ *
+ * All Rights Reserved.
+ */
+
+/*
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2 as published by the
+ * Free Software Foundation. See the LICENSE file included with
+ * this program for more details.
+ *
+ * In addition, when this program is distributed with Asterisk in
+ * any form that would qualify as a 'combined work' or as a
+ * 'derivative work' (but not mere aggregation), you can redistribute
+ * and/or modify the combination under the terms of the license
+ * provided with that copy of Asterisk, instead of the license
+ * terms granted here.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libss7.h"
+#include "ss7_internal.h"
+#include "mtp2.h"
+#include "mtp3.h"
+#include "isup.h"
+
+#define SS7_SHM_DEFAULT_INTERVAL	1000
+
+struct ss7_shm_writer {
+	char name[64];
+	struct ss7_shm *shm;
+	int interval;
+	int sched;
+};
+
+static void shm_publish_timer(void *data)
+{
+	struct ss7 *ss7 = data;
+
+	ss7->shm->sched = -1;
+	ss7_shm_publish(ss7);
+	ss7->shm->sched = ss7_schedule_event(ss7, ss7->shm->interval, shm_publish_timer, ss7);
+}
+
+int ss7_shm_start(struct ss7 *ss7, const char *name, int interval)
+{
+	struct ss7_shm_writer *w;
+	int fd;
+
+	if (!ss7 || !name)
+		return -1;
+
+	if (ss7->shm) {
+		ss7_error(ss7, "Statistics already published in %s\n", ss7->shm->name);
+		return -1;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -1;
+
+	fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		ss7_error(ss7, "Unable to open shared memory %s\n", name);
+		free(w);
+		return -1;
+	}
+
+	if (ftruncate(fd, sizeof(struct ss7_shm)) < 0) {
+		ss7_error(ss7, "Unable to size shared memory %s\n", name);
+		close(fd);
+		shm_unlink(name);
+		free(w);
+		return -1;
+	}
+
+	w->shm = mmap(NULL, sizeof(struct ss7_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (w->shm == MAP_FAILED) {
+		ss7_error(ss7, "Unable to map shared memory %s\n", name);
+		shm_unlink(name);
+		free(w);
+		return -1;
+	}
+
+	strncpy(w->name, name, sizeof(w->name) - 1);
+	w->interval = (interval > 0) ? interval : SS7_SHM_DEFAULT_INTERVAL;
+
+	/* Readers check magic and version before trusting anything else */
+	memset(w->shm, 0, sizeof(struct ss7_shm));
+	w->shm->size = sizeof(struct ss7_shm);
+	w->shm->version = SS7_SHM_VERSION;
+	__sync_synchronize();
+	w->shm->magic = SS7_SHM_MAGIC;
+
+	ss7->shm = w;
+	ss7_shm_publish(ss7);
+	w->sched = ss7_schedule_event(ss7, w->interval, shm_publish_timer, ss7);
+
+	return 0;
+}
+
+void ss7_shm_publish(struct ss7 *ss7)
+{
+	struct ss7_shm *shm;
+	struct ss7_shm_link *sl;
+	struct mtp2 *link;
+	struct timeval now;
+	int i;
+
+	if (!ss7 || !ss7->shm)
+		return;
+
+	shm = ss7->shm->shm;
+	gettimeofday(&now, NULL);
+
+	/* Odd sequence tells readers to retry */
+	shm->seq++;
+	__sync_synchronize();
+
+	shm->updates++;
+	shm->updated_sec = now.tv_sec;
+	shm->updated_usec = now.tv_usec;
+	shm->pc = ss7->pc;
+	shm->state = ss7->state;
+	shm->event_queue = ss7->ev_len;
+	/* The calls of a sharded linkset are on its shards */
+	shm->calls = ss7->numcalls;
+	for (i = 0; ss7->shards && i < ss7->numshards; i++)
+		shm->calls += ss7->shards[i]->numcalls;
+
+	shm->numlinks = 0;
+	for (i = 0; i < ss7->numlinks && i < SS7_SHM_MAX_LINKS; i++) {
+		link = ss7->links[i];
+		sl = &shm->links[i];
+		strncpy(sl->mtp2_state, linkstate2strext(link->state), sizeof(sl->mtp2_state) - 1);
+		sl->mtp3_up = (link->adj_sp && link->adj_sp->state == MTP3_UP);
+		sl->inhibited = link->inhibit;
+		mtp2_get_stats(link, &sl->stats);
+		shm->numlinks++;
+	}
+
+	shm->sched = ss7->sched_stats;
+	isup_get_stats(ss7, &shm->isup);
+
+	__sync_synchronize();
+	shm->seq++;
+}
+
+void ss7_shm_free(struct ss7 *ss7)
+{
+	struct ss7_shm_writer *w = ss7->shm;
+
+	if (!w)
+		return;
+
+	ss7->shm = NULL;
+	munmap(w->shm, sizeof(struct ss7_shm));
+	shm_unlink(w->name);
+	free(w);
+}
+
+void ss7_shm_stop(struct ss7 *ss7)
+{
+	if (!ss7 || !ss7->shm)
+		return;
+
+	ss7_schedule_del(ss7, &ss7->shm->sched);
+	ss7_shm_free(ss7);
+}
+
+/* Monitor side, never writes to the region */
+const struct ss7_shm * ss7_shm_attach(const char *name)
+{
+	const struct ss7_shm *shm;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct ss7_shm)) {
+		close(fd);
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(struct ss7_shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+
+	if (shm->magic != SS7_SHM_MAGIC || shm->version != SS7_SHM_VERSION || shm->size != sizeof(struct ss7_shm)) {
+		munmap((void *) shm, sizeof(struct ss7_shm));
+		return NULL;
+	}
+
+	return shm;
+}
+
+void ss7_shm_detach(const struct ss7_shm *shm)
+{
+	if (shm)
+		munmap((void *) shm, sizeof(struct ss7_shm));
+}
+
+int ss7_shm_read(const struct ss7_shm *shm, struct ss7_shm *copy)
+{
+	unsigned int seq;
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		seq = shm->seq;
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		__sync_synchronize();
+		memcpy(copy, (const void *) shm, sizeof(*copy));
+		__sync_synchronize();
+		if (shm->seq == seq)
+			return 0;
+	}
+
+	return -1;
+}
@@ -0,0 +1,1029 @@
+/*
+ * libss7: An implementation of Signalling System 7
+ *
+ * Library owned protocol thread with lock free command and event queues
+ *
+ * All Rights Reserved.
+ */
+
+/*
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2 as published by the
+ * Free Software Foundation. See the LICENSE file included with
+ * this program for more details.
+ *
+ * In addition, when this program is distributed with Asterisk in
+ * any form that would qualify as a 'combined work' or as a
+ * 'derivative work' (but not mere aggregation), you can redistribute
+ * and/or modify the combination under the terms of the license
+ * provided with that copy of Asterisk, instead of the license
+ * terms granted here.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "libss7.h"
+#include "ss7_internal.h"
+#include "mtp2.h"
+#include "mtp3.h"
+#include "isup.h"
+
+#define SS7_THREAD_DEFAULT_EVENTS	1024
+/* Retry interval while the application does not take its events */
+#define SS7_THREAD_EVENT_RETRY		10
+
+/* CICs go to the ISUP shards in blocks laid out like E1 systems unless
+ * told otherwise, so the CICs of a range message are all on one shard */
+#define SS7_SHARD_CIC_BLOCK		32
+
+/* Lock free list, pushed by any thread and taken whole by one */
+struct ss7_qnode {
+	struct ss7_qnode *next;
+};
+
+struct ss7_cmd_node {
+	struct ss7_qnode q;
+	struct ss7_cmd cmd;
+};
+
+/* MSU passed between the I/O thread and an ISUP shard, or up from MTP2 */
+struct ss7_msu_node {
+	struct ss7_qnode q;
+	struct routing_label rl;
+	unsigned char userpart;
+	struct ss7_msg *m;	/* towards MTP3 */
+	struct mtp2 *link;	/* from MTP2 */
+	int relay;		/* 'm' relayed from another linkset */
+	int len;		/* towards ISUP or MTP3 */
+	unsigned char buf[0];
+};
+
+struct ss7_thread {
+	pthread_t thread;
+	volatile int stop;
+	void (*link_event)(struct ss7 *ss7, int fd);
+
+	/* Commands, pushed by any thread, taken all at once by the protocol thread */
+	struct ss7_qnode * volatile cmds;
+	/* MSUs from the shards on a linkset, to ISUP on a shard */
+	struct ss7_qnode * volatile msus;
+	int wake[2];
+
+	/* Events, single producer (protocol thread), single consumer */
+	unsigned int size; /* always a power of two */
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	ss7_event *events;
+	/* Shards signal their events through the pipe of the linkset */
+	int notify[2];
+	int kick;
+	int next_ring;
+
+	/* MTP2 thread, shares the linkset with this one under 'lock' */
+	pthread_t mtp2_thread;
+	int mtp2_running;
+	int mtp2_wake[2];
+	volatile int mtp2_kicked;
+	struct ss7_qnode * volatile up;
+	pthread_mutex_t lock;
+};
+
+/* Returns 1 if the list was empty */
+static int queue_push(struct ss7_qnode * volatile *head, struct ss7_qnode *n)
+{
+	struct ss7_qnode *old;
+
+	do {
+		old = *head;
+		n->next = old;
+	} while (!__sync_bool_compare_and_swap(head, old, n));
+
+	return !old;
+}
+
+static struct ss7_qnode * queue_take(struct ss7_qnode * volatile *head)
+{
+	struct ss7_qnode *list, *prev = NULL, *next;
+
+	list = __sync_lock_test_and_set(head, NULL);
+
+	/* Pushed newest first */
+	while (list) {
+		next = list->next;
+		list->next = prev;
+		prev = list;
+		list = next;
+	}
+
+	return prev;
+}
+
+static void thread_pipe_drain(int fd)
+{
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static void thread_pipe_kick(int fd)
+{
+	char c = 0;
+
+	/* A full pipe already wakes the reader */
+	if (write(fd, &c, 1) < 0)
+		return;
+}
+
+static int thread_pipe_open(int fds[2])
+{
+	if (pipe(fds) < 0)
+		return -1;
+
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+	return 0;
+}
+
+static void thread_pipe_close(int fds[2])
+{
+	if (fds[0] > -1)
+		close(fds[0]);
+	if (fds[1] > -1)
+		close(fds[1]);
+}
+
+static int thread_cic_call(struct ss7 *ss7, struct ss7_cmd *cmd)
+{
+	struct isup_call *c;
+
+	c = isup_new_call(ss7);
+	if (!c)
+		return -1;
+	isup_init_call(ss7, c, cmd->cic, cmd->dpc);
+
+	switch (cmd->cmd) {
+		case SS7_CMD_GRS:
+			return isup_grs(ss7, c, cmd->endcic);
+		case SS7_CMD_CGB:
+			return isup_cgb(ss7, c, cmd->endcic, cmd->state, cmd->type);
+		case SS7_CMD_CGU:
+			return isup_cgu(ss7, c, cmd->endcic, cmd->state, cmd->type);
+		case SS7_CMD_BLO:
+			return isup_blo(ss7, c);
+		case SS7_CMD_UBL:
+			return isup_ubl(ss7, c);
+		case SS7_CMD_RSC:
+			return isup_rsc(ss7, c);
+	}
+
+	return -1;
+}
+
+static int thread_run_command(struct ss7 *ss7, struct ss7_cmd *cmd)
+{
+	struct isup_call *c = cmd->call;
+
+	switch (cmd->cmd) {
+		case SS7_CMD_START:
+			return ss7_start(ss7);
+		case SS7_CMD_FUNC:
+			if (cmd->func)
+				cmd->func(ss7, cmd->data);
+			return 0;
+		case SS7_CMD_GRS:
+		case SS7_CMD_CGB:
+		case SS7_CMD_CGU:
+		case SS7_CMD_BLO:
+		case SS7_CMD_UBL:
+		case SS7_CMD_RSC:
+			return thread_cic_call(ss7, cmd);
+	}
+
+	if (!c)
+		return -1;
+
+	switch (cmd->cmd) {
+		case SS7_CMD_IAM:
+			isup_link_call(ss7, c);
+			isup_init_call(ss7, c, cmd->cic, cmd->dpc);
+			return isup_iam(ss7, c);
+		case SS7_CMD_ACM:
+			return isup_acm(ss7, c);
+		case SS7_CMD_ANM:
+			return isup_anm(ss7, c);
+		case SS7_CMD_CON:
+			return isup_con(ss7, c);
+		case SS7_CMD_CPG:
+			return isup_cpg(ss7, c, cmd->event);
+		case SS7_CMD_REL:
+			return isup_rel(ss7, c, cmd->cause);
+		case SS7_CMD_RLC:
+			return isup_rlc(ss7, c);
+		case SS7_CMD_FREE:
+			isup_free_call(ss7, c);
+			return 0;
+	}
+
+	return -1;
+}
+
+/* The linkset is given back to MTP2 between commands and MSUs */
+static inline void thread_lock(struct ss7 *ss7)
+{
+	if (ss7->mtp2_timers)
+		pthread_mutex_lock(&ss7->thread->lock);
+}
+
+static inline void thread_unlock(struct ss7 *ss7)
+{
+	if (ss7->mtp2_timers)
+		pthread_mutex_unlock(&ss7->thread->lock);
+}
+
+static void thread_run_commands(struct ss7 *ss7)
+{
+	struct ss7_thread *t = ss7->thread;
+	struct ss7_qnode *q, *next;
+	struct ss7_cmd_node *n;
+
+	for (q = queue_take(&t->cmds); q; q = next) {
+		next = q->next;
+		n = (struct ss7_cmd_node *) q;
+		thread_lock(ss7);
+		if (thread_run_command(ss7, &n->cmd) < 0)
+			ss7_error(ss7, "Command %d for CIC %d failed\n", n->cmd.cmd,
+				n->cmd.call ? n->cmd.call->cic : n->cmd.cic);
+		thread_unlock(ss7);
+		free(n);
+	}
+}
+
+static void thread_run_msus(struct ss7 *ss7)
+{
+	struct ss7_thread *t = ss7->thread;
+	struct ss7_qnode *q, *next;
+	struct ss7_msu_node *n;
+
+	for (q = queue_take(&t->msus); q; q = next) {
+		next = q->next;
+		n = (struct ss7_msu_node *) q;
+		thread_lock(ss7);
+		if (ss7->parent)
+			isup_receive(ss7, NULL, &n->rl, n->buf, n->len);
+		else if (n->relay)
+			mtp3_relay(ss7, n->rl, n->m);
+		else
+			mtp3_transmit(ss7, n->userpart, n->rl, n->m, NULL);
+		thread_unlock(ss7);
+		free(n);
+	}
+}
+
+/* MSUs from the MTP2 thread, the linkset is free for MTP2 between them */
+static void thread_run_up(struct ss7 *ss7)
+{
+	struct ss7_thread *t = ss7->thread;
+	struct ss7_qnode *q, *next;
+	struct ss7_msu_node *n;
+
+	for (q = queue_take(&t->up); q; q = next) {
+		next = q->next;
+		n = (struct ss7_msu_node *) q;
+		pthread_mutex_lock(&t->lock);
+		mtp3_receive(ss7, n->link, n->buf, n->len);
+		pthread_mutex_unlock(&t->lock);
+		free(n);
+	}
+}
+
+static void shard_free_calls(struct ss7 *ss7, void *data)
+{
+	isup_free_all_calls(ss7);
+}
+
+static int thread_queue_command(struct ss7 *ss7, const struct ss7_cmd *cmd)
+{
+	struct ss7_cmd_node *n;
+
+	n = malloc(sizeof(*n));
+	if (!n)
+		return -1;
+	n->cmd = *cmd;
+
+	/* Only the first command of a batch needs to wake the thread */
+	if (queue_push(&ss7->thread->cmds, &n->q))
+		thread_pipe_kick(ss7->thread->wake[1]);
+
+	return 0;
+}
+
+unsigned int ss7_event_backlog(struct ss7 *ss7)
+{
+	unsigned int res = ss7->ev_len;
+
+	if (ss7->thread)
+		res += ss7->thread->head - ss7->thread->tail;
+
+	return res;
+}
+
+/* Moves events to the application ring while there is room for them */
+static int thread_move_events(struct ss7 *ss7)
+{
+	struct ss7_thread *t = ss7->thread;
+	ss7_event *e;
+	unsigned int head;
+
+	while (ss7->ev_len) {
+		head = t->head;
+		if (head - t->tail >= t->size)
+			return -1;
+
+		e = ss7_check_event(ss7);
+		if (!e)
+			continue;
+
+		/* The linkset went down, the calls of its shards go as well */
+		if (e->e == SS7_EVENT_DOWN && ss7->shards) {
+			struct ss7_cmd cmd;
+			int i;
+
+			memset(&cmd, 0, sizeof(cmd));
+			cmd.cmd = SS7_CMD_FUNC;
+			cmd.func = shard_free_calls;
+			for (i = 0; i < ss7->numshards; i++)
+				thread_queue_command(ss7->shards[i], &cmd);
+		}
+
+		t->events[head & (t->size - 1)] = *e;
+
+		/* Make the event visible before publishing the new head */
+		__sync_synchronize();
+		t->head = head + 1;
+		__sync_synchronize();
+
+		/* A consumer with older events left still finds this one */
+		if (t->tail == head)
+			thread_pipe_kick(t->kick);
+	}
+
+	return 0;
+}
+
+static int thread_timeout(struct ss7 *ss7, int retry)
+{
+	struct timeval *next, now;
+	long ms;
+
+	next = ss7_schedule_next(ss7);
+	if (!next)
+		return retry ? SS7_THREAD_EVENT_RETRY : -1;
+
+	gettimeofday(&now, NULL);
+	ms = ss7_tvdiff_usec(next, &now) / 1000;
+	if (ms < 0)
+		ms = 0;
+	if (retry && ms > SS7_THREAD_EVENT_RETRY)
+		ms = SS7_THREAD_EVENT_RETRY;
+
+	return ms;
+}
+
+static void * thread_run(void *data)
+{
+	struct ss7 *ss7 = data;
+	struct ss7_thread *t = ss7->thread;
+	struct pollfd fds[SS7_MAX_LINKS + 1];
+	/* Links belong to the MTP2 thread if there is one */
+	int numlinks = ss7->mtp2_timers ? 0 : ss7->numlinks;
+	int i, res, timeout, retry = 0;
+
+	while (!t->stop) {
+		fds[0].fd = t->wake[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		for (i = 0; i < numlinks; i++) {
+			fds[i + 1].fd = ss7->links[i]->fd;
+			fds[i + 1].events = ss7_pollflags(ss7, ss7->links[i]->fd);
+			fds[i + 1].revents = 0;
+		}
+
+		thread_lock(ss7);
+		timeout = thread_timeout(ss7, retry);
+		thread_unlock(ss7);
+
+		res = poll(fds, numlinks + 1, timeout);
+		if (res < 0)
+			continue;
+
+		if (fds[0].revents) {
+			thread_pipe_drain(t->wake[0]);
+			thread_run_commands(ss7);
+			thread_run_msus(ss7);
+			if (ss7->mtp2_timers)
+				thread_run_up(ss7);
+		}
+
+		for (i = 0; i < numlinks; i++) {
+			if ((fds[i + 1].revents & POLLPRI) && t->link_event)
+				t->link_event(ss7, fds[i + 1].fd);
+			if (fds[i + 1].revents & POLLIN)
+				ss7_read(ss7, fds[i + 1].fd);
+			if (fds[i + 1].revents & POLLOUT)
+				ss7_write(ss7, fds[i + 1].fd);
+		}
+
+		thread_lock(ss7);
+		ss7_schedule_run(ss7);
+		retry = thread_move_events(ss7);
+		thread_unlock(ss7);
+	}
+
+	return NULL;
+}
+
+/* Only MTP2 and its timers, it never waits longer than one MSU of the
+ * protocol thread takes */
+static void * mtp2_thread_run(void *data)
+{
+	struct ss7 *ss7 = data;
+	struct ss7_thread *t = ss7->thread;
+	struct pollfd fds[SS7_MAX_LINKS + 1];
+	int i, timeout, events;
+
+	while (!t->stop) {
+		fds[0].fd = t->mtp2_wake[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+
+		pthread_mutex_lock(&t->lock);
+		for (i = 0; i < ss7->numlinks; i++) {
+			fds[i + 1].fd = ss7->links[i]->fd;
+			fds[i + 1].events = ss7_pollflags(ss7, ss7->links[i]->fd);
+			fds[i + 1].revents = 0;
+		}
+		timeout = thread_timeout(ss7->mtp2_timers, 0);
+		pthread_mutex_unlock(&t->lock);
+
+		if (poll(fds, ss7->numlinks + 1, timeout) < 0)
+			continue;
+
+		if (fds[0].revents) {
+			/* Cleared after the drain so a kick from now on stays in the pipe,
+			 * one skipped before left an MSU the next pass polls for */
+			thread_pipe_drain(t->mtp2_wake[0]);
+			__sync_synchronize();
+			t->mtp2_kicked = 0;
+		}
+
+		pthread_mutex_lock(&t->lock);
+		for (i = 0; i < ss7->numlinks; i++) {
+			if ((fds[i + 1].revents & POLLPRI) && t->link_event)
+				t->link_event(ss7, fds[i + 1].fd);
+			if (fds[i + 1].revents & POLLIN)
+				ss7_read(ss7, fds[i + 1].fd);
+			if (fds[i + 1].revents & POLLOUT)
+				ss7_write(ss7, fds[i + 1].fd);
+		}
+		ss7_schedule_run(ss7->mtp2_timers);
+		events = ss7->ev_len;
+		pthread_mutex_unlock(&t->lock);
+
+		/* Link state changes are reported as events */
+		if (events)
+			thread_pipe_kick(t->wake[1]);
+	}
+
+	return NULL;
+}
+
+int ss7_mtp2_deliver(struct mtp2 *link, unsigned char *buf, int len)
+{
+	struct ss7 *ss7 = link->master;
+	struct ss7_msu_node *n;
+
+	if (!ss7->thread)
+		return mtp3_receive(ss7, link, buf, len);
+
+	n = malloc(sizeof(*n) + len);
+	if (!n)
+		return -1;
+
+	n->link = link;
+	n->m = NULL;
+	n->len = len;
+	memcpy(n->buf, buf, len);
+
+	if (queue_push(&ss7->thread->up, &n->q))
+		thread_pipe_kick(ss7->thread->wake[1]);
+
+	return 0;
+}
+
+/* MSU queued on the protocol thread, MTP2 polls the links for writing again */
+void ss7_mtp2_kick(struct ss7 *ss7)
+{
+	struct ss7_thread *t = ss7->thread;
+
+	if (!t || !t->mtp2_running || t->mtp2_kicked)
+		return;
+
+	t->mtp2_kicked = 1;
+	thread_pipe_kick(t->mtp2_wake[1]);
+}
+
+int ss7_set_mtp2_thread(struct ss7 *ss7)
+{
+	struct ss7 *s;
+
+	if (!ss7)
+		return -1;
+
+	if (ss7->thread) {
+		ss7_error(ss7, "The MTP2 thread has to be set before the protocol thread starts\n");
+		return -1;
+	}
+
+	if (ss7->mtp2_timers)
+		return 0;
+
+	s = ss7_new(ss7->switchtype);
+	if (!s)
+		return -1;
+
+	s->cb = ss7->cb;
+	s->userdata = ss7->userdata;
+	s->sched_warn_usec = ss7->sched_warn_usec;
+	ss7->mtp2_timers = s;
+
+	return 0;
+}
+
+static void thread_free(struct ss7_thread *t)
+{
+	struct ss7_qnode *q, *next;
+
+	for (q = queue_take(&t->cmds); q; q = next) {
+		next = q->next;
+		free(q);
+	}
+	for (q = queue_take(&t->msus); q; q = next) {
+		next = q->next;
+		if (((struct ss7_msu_node *) q)->m)
+			ss7_msg_free(((struct ss7_msu_node *) q)->m);
+		free(q);
+	}
+	for (q = queue_take(&t->up); q; q = next) {
+		next = q->next;
+		free(q);
+	}
+	if (t->mtp2_running)
+		pthread_mutex_destroy(&t->lock);
+	thread_pipe_close(t->mtp2_wake);
+	thread_pipe_close(t->wake);
+	thread_pipe_close(t->notify);
+	free(t->events);
+	free(t);
+}
+
+static struct ss7_thread * thread_new(unsigned int events, int notify)
+{
+	struct ss7_thread *t;
+	unsigned int x = 1;
+
+	if (!events)
+		events = SS7_THREAD_DEFAULT_EVENTS;
+	while (x < events)
+		x <<= 1;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->wake[0] = t->wake[1] = t->notify[0] = t->notify[1] = -1;
+	t->mtp2_wake[0] = t->mtp2_wake[1] = -1;
+	t->size = x;
+	t->events = calloc(x, sizeof(ss7_event));
+
+	if (!t->events || thread_pipe_open(t->wake) || (notify && thread_pipe_open(t->notify))) {
+		thread_free(t);
+		return NULL;
+	}
+	t->kick = t->notify[1];
+
+	return t;
+}
+
+static struct ss7 * shard_new(struct ss7 *ss7)
+{
+	struct ss7 *s;
+	int i;
+
+	s = ss7_new(ss7->switchtype);
+	if (!s)
+		return NULL;
+
+	s->cb = ss7->cb;
+	s->userdata = ss7->userdata;
+	s->pc = ss7->pc;
+	s->ni = ss7->ni;
+	s->debug = ss7->debug;
+	s->flags = ss7->flags;
+	s->sls_shift = ss7->sls_shift;
+	s->cause_location = ss7->cause_location;
+	s->sched_warn_usec = ss7->sched_warn_usec;
+	memcpy(s->isup_timers, ss7->isup_timers, sizeof(s->isup_timers));
+	for (i = 0; i < 3; i++)
+		ss7_set_call_gapping(s, i, ss7->call_gap[i].rate, ss7->call_gap[i].burst);
+	s->call_gap_shares = ss7->numshards;
+	memcpy(s->overload, ss7->overload, sizeof(s->overload));
+	if (ss7->call_snapshot)
+		isup_publish_calls(s, ss7->call_snapshot->interval);
+	s->parent = ss7;
+
+	return s;
+}
+
+static void shards_stop(struct ss7 *ss7)
+{
+	int i;
+
+	for (i = 0; i < ss7->numshards; i++) {
+		if (ss7->shards[i])
+			ss7_destroy(ss7->shards[i]);
+	}
+	free(ss7->shards);
+	ss7->shards = NULL;
+}
+
+static int shards_start(struct ss7 *ss7, unsigned int events)
+{
+	struct ss7 *s;
+	int i;
+
+	ss7->shards = calloc(ss7->numshards, sizeof(struct ss7 *));
+	if (!ss7->shards)
+		return -1;
+
+	for (i = 0; i < ss7->numshards; i++) {
+		s = shard_new(ss7);
+		if (!s)
+			return -1;
+		ss7->shards[i] = s;
+
+		s->thread = thread_new(events, 0);
+		if (!s->thread)
+			return -1;
+		s->thread->kick = ss7->thread->notify[1];
+
+		if (pthread_create(&s->thread->thread, NULL, thread_run, s)) {
+			thread_free(s->thread);
+			s->thread = NULL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int ss7_set_isup_shards(struct ss7 *ss7, int shards, int block)
+{
+	if (!ss7 || shards < 0 || block < 0)
+		return -1;
+
+	if (ss7->thread) {
+		ss7_error(ss7, "ISUP shards have to be set before the protocol thread starts\n");
+		return -1;
+	}
+
+	ss7->numshards = (shards > 1) ? shards : 0;
+	ss7->shard_block = block ? block : SS7_SHARD_CIC_BLOCK;
+
+	return 0;
+}
+
+int ss7_thread_start(struct ss7 *ss7, unsigned int events, void (*link_event)(struct ss7 *ss7, int fd))
+{
+	struct ss7_thread *t;
+
+	if (!ss7)
+		return -1;
+
+	if (ss7->thread) {
+		ss7_error(ss7, "Protocol thread already running\n");
+		return -1;
+	}
+
+	t = thread_new(events, 1);
+	if (!t) {
+		ss7_error(ss7, "Unable to set up protocol thread\n");
+		return -1;
+	}
+	t->link_event = link_event;
+	ss7->thread = t;
+
+	/* Shards are running before the first MSU can reach them */
+	if (ss7->numshards && shards_start(ss7, events)) {
+		ss7_error(ss7, "Unable to start ISUP shards\n");
+		shards_stop(ss7);
+		ss7->thread = NULL;
+		thread_free(t);
+		return -1;
+	}
+
+	if (ss7->mtp2_timers) {
+		if (thread_pipe_open(t->mtp2_wake)) {
+			ss7_error(ss7, "Unable to set up MTP2 thread\n");
+			shards_stop(ss7);
+			ss7->thread = NULL;
+			thread_free(t);
+			return -1;
+		}
+		pthread_mutex_init(&t->lock, NULL);
+		t->mtp2_running = 1;
+	}
+
+	if (pthread_create(&t->thread, NULL, thread_run, ss7)) {
+		ss7_error(ss7, "Unable to start protocol thread\n");
+		shards_stop(ss7);
+		ss7->thread = NULL;
+		thread_free(t);
+		return -1;
+	}
+
+	if (t->mtp2_running && pthread_create(&t->mtp2_thread, NULL, mtp2_thread_run, ss7)) {
+		ss7_error(ss7, "Unable to start MTP2 thread\n");
+		t->mtp2_running = 0;
+		ss7_thread_stop(ss7);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ss7_thread_stop(struct ss7 *ss7)
+{
+	struct ss7_thread *t;
+
+	if (!ss7 || !ss7->thread)
+		return;
+
+	t = ss7->thread;
+	t->stop = 1;
+	thread_pipe_kick(t->wake[1]);
+	pthread_join(t->thread, NULL);
+	if (t->mtp2_running) {
+		thread_pipe_kick(t->mtp2_wake[1]);
+		pthread_join(t->mtp2_thread, NULL);
+	}
+
+	/* Nothing reaches the shards anymore */
+	if (ss7->shards)
+		shards_stop(ss7);
+
+	ss7->thread = NULL;
+	thread_free(t);
+}
+
+static struct ss7 * shard_for(struct ss7 *ss7, unsigned int pc, int cic)
+{
+	return ss7->shards[(pc * 31 + (unsigned int) cic / ss7->shard_block) % ss7->numshards];
+}
+
+static inline int shard_range_split(struct ss7 *ss7, int cic, int endcic)
+{
+	return cic / ss7->shard_block != endcic / ss7->shard_block;
+}
+
+static struct ss7 * shard_for_command(struct ss7 *ss7, const struct ss7_cmd *cmd)
+{
+	switch (cmd->cmd) {
+		case SS7_CMD_START:
+			return ss7;
+		case SS7_CMD_FUNC:
+			/* Answers to GRS, CGB, BLO and the like are sent this way */
+			if (cmd->call)
+				return shard_for(ss7, cmd->call->dpc, cmd->call->cic);
+			if (cmd->dpc)
+				return shard_for(ss7, cmd->dpc, cmd->cic);
+			return ss7;
+		case SS7_CMD_IAM:
+		case SS7_CMD_GRS:
+		case SS7_CMD_CGB:
+		case SS7_CMD_CGU:
+		case SS7_CMD_BLO:
+		case SS7_CMD_UBL:
+		case SS7_CMD_RSC:
+			return shard_for(ss7, cmd->dpc, cmd->cic);
+	}
+
+	if (cmd->call)
+		return shard_for(ss7, cmd->call->dpc, cmd->call->cic);
+
+	return ss7;
+}
+
+int ss7_thread_command(struct ss7 *ss7, const struct ss7_cmd *cmd)
+{
+	if (!ss7 || !ss7->thread || !cmd)
+		return -1;
+
+	if (ss7->shards) {
+		if ((cmd->cmd == SS7_CMD_GRS || cmd->cmd == SS7_CMD_CGB || cmd->cmd == SS7_CMD_CGU) &&
+				shard_range_split(ss7, cmd->cic, cmd->endcic)) {
+			ss7_error(ss7, "CIC range %d-%d crosses ISUP shards, not sent\n", cmd->cic, cmd->endcic);
+			return -1;
+		}
+		ss7 = shard_for_command(ss7, cmd);
+	}
+
+	return thread_queue_command(ss7, cmd);
+}
+
+/* Range of a circuit group message, 0 for the others and -1 if truncated */
+static int shard_msg_range(unsigned char *buf, int len)
+{
+	struct isup_h *mh = (struct isup_h *) buf;
+	int ptr;
+
+	switch (mh->type) {
+		case ISUP_GRS:
+		case ISUP_GRA:
+		case ISUP_CQM:
+		case ISUP_CQR:
+			ptr = 0;
+			break;
+		case ISUP_CGB:
+		case ISUP_CGU:
+		case ISUP_CGBA:
+		case ISUP_CGUA:
+			/* After the circuit group supervision type */
+			ptr = 1;
+			break;
+		default:
+			return 0;
+	}
+
+	/* Range and status is the first variable parameter: length, range */
+	if (CIC_SIZE + 1 + ptr >= len || CIC_SIZE + 1 + ptr + mh->data[ptr] + 1 >= len)
+		return -1;
+
+	return mh->data[ptr + mh->data[ptr] + 1];
+}
+
+/* Runs on the I/O thread, keeps the messages of a CIC in order on one shard */
+int ss7_shard_receive(struct ss7 *ss7, struct routing_label *rl, unsigned char *buf, int len)
+{
+	struct isup_h *mh = (struct isup_h *) buf;
+	struct ss7_msu_node *n;
+	struct ss7 *s;
+	int cic, range;
+
+	if (len < 3)
+		return -1;
+
+	if (ss7->switchtype == SS7_ITU)
+		cic = mh->cic[0] | ((mh->cic[1] & 0x0f) << 8);
+	else
+		cic = mh->cic[0] | ((mh->cic[1] & 0x3f) << 8);
+
+	range = shard_msg_range(buf, len);
+	if (range < 0 || shard_range_split(ss7, cic, cic + range)) {
+		ss7_error(ss7, "%s for CIC %d range %d crosses ISUP shards, dropping\n", isup_message2str(mh->type), cic, range);
+		return -1;
+	}
+
+	n = malloc(sizeof(*n) + len);
+	if (!n)
+		return -1;
+
+	n->rl = *rl;
+	n->m = NULL;
+	n->len = len;
+	memcpy(n->buf, buf, len);
+
+	s = shard_for(ss7, rl->opc, cic);
+	if (queue_push(&s->thread->msus, &n->q))
+		thread_pipe_kick(s->thread->wake[1]);
+
+	return 0;
+}
+
+/* Runs on a shard, MTP3 routing is left to the I/O thread */
+int ss7_shard_transmit(struct ss7 *ss7, unsigned char userpart, struct routing_label rl, struct ss7_msg *m)
+{
+	struct ss7 *p = ss7->parent;
+	struct ss7_msu_node *n;
+
+	n = malloc(sizeof(*n));
+	if (!n) {
+		ss7_msg_free(m);
+		return -1;
+	}
+
+	n->rl = rl;
+	n->userpart = userpart;
+	n->m = m;
+	n->relay = 0;
+	n->len = 0;
+
+	if (queue_push(&p->thread->msus, &n->q))
+		thread_pipe_kick(p->thread->wake[1]);
+
+	return 0;
+}
+
+int ss7_relay_transmit(struct ss7 *ss7, struct routing_label rl, struct ss7_msg *m)
+{
+	struct ss7_msu_node *n;
+
+	if (!ss7->thread || pthread_equal(pthread_self(), ss7->thread->thread))
+		return mtp3_relay(ss7, rl, m);
+
+	n = malloc(sizeof(*n));
+	if (!n) {
+		ss7_msg_free(m);
+		return -1;
+	}
+
+	n->rl = rl;
+	n->m = m;
+	n->relay = 1;
+	n->len = 0;
+
+	if (queue_push(&ss7->thread->msus, &n->q))
+		thread_pipe_kick(ss7->thread->wake[1]);
+
+	return 0;
+}
+
+static int ring_get(struct ss7_thread *t, ss7_event *e)
+{
+	unsigned int tail = t->tail;
+
+	if (tail == t->head)
+		return 0;
+
+	__sync_synchronize();
+	*e = t->events[tail & (t->size - 1)];
+	__sync_synchronize();
+	t->tail = tail + 1;
+
+	return 1;
+}
+
+/* Takes turns between the linkset and its shards */
+static int thread_get_event(struct ss7 *ss7, ss7_event *e)
+{
+	struct ss7_thread *t = ss7->thread;
+	struct ss7 *s;
+	int i, n, rings = ss7->shards ? ss7->numshards + 1 : 1;
+
+	for (i = 0; i < rings; i++) {
+		n = (t->next_ring + i) % rings;
+		s = n ? ss7->shards[n - 1] : ss7;
+		if (ring_get(s->thread, e)) {
+			t->next_ring = (n + 1) % rings;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int ss7_thread_event(struct ss7 *ss7, ss7_event *e)
+{
+	if (!ss7 || !ss7->thread || !e)
+		return -1;
+
+	if (thread_get_event(ss7, e))
+		return 1;
+
+	/* Drain before looking again so a new event always kicks the pipe */
+	thread_pipe_drain(ss7->thread->notify[0]);
+	__sync_synchronize();
+
+	return thread_get_event(ss7, e);
+}
+
+int ss7_thread_event_fd(struct ss7 *ss7)
+{
+	if (!ss7 || !ss7->thread)
+		return -1;
+
+	return ss7->thread->notify[0];
+}
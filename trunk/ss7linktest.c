@@ -306,6 +306,9 @@ int main(int argc, char *argv[])
 	if (fd == -1)
 		return -1;
 
+	ss7_set_message(myprintf);
+	ss7_set_error(myprintf);
+
 	if (!(ss7 = ss7_new(type))) {
 		perror("ss7_new");
 		exit(1);
@@ -314,8 +317,6 @@ int main(int argc, char *argv[])
 	linkset[0].fd = fd;
 	linkset[0].linkno = 0;
 
-	ss7_set_message(myprintf);
-	ss7_set_error(myprintf);
 	ss7_set_network_ind(ss7, SS7_NI_NAT);
 
 	ss7_set_debug(ss7, 0xfffffff);
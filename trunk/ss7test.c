@@ -206,6 +206,9 @@ int main(int argc, char *argv[])
 	} else
 		return -1;
 
+	ss7_set_message(myprintf);
+	ss7_set_error(myprintf);
+
 	if (!(ss7 = ss7_new(SS7_ITU))) {
 		perror("ss7_new");
 		exit(1);
@@ -214,9 +217,6 @@ int main(int argc, char *argv[])
 	linkset[0].fd = fds[0];
 	linkset[0].linkno = 0;
 
-	ss7_set_message(myprintf);
-	ss7_set_error(myprintf);
-
 	ss7_set_debug(ss7, 0xffffffff);
 	if ((ss7_add_link(ss7, SS7_TRANSPORT_DAHDIDCHAN, fds[0]))) {
 		perror("ss7_add_link");